@@ -0,0 +1,67 @@
+#include "ActiveTiles.h"
+#include <algorithm>
+
+void ActiveTiles::resize(uint32_t nx, uint32_t ny) {
+    m_nx = nx;
+    m_ny = ny;
+    m_tilesX = (nx + TILE - 1)/TILE;
+    m_tilesY = (ny + TILE - 1)/TILE;
+    m_active.assign((size_t) m_tilesX*m_tilesY, 0);
+    m_spanBegin.assign(m_tilesY, 1);
+    m_spanEnd.assign(m_tilesY, 0);
+    m_rowBegin = m_rowEnd = 1;
+}
+
+void ActiveTiles::clear() {
+    std::fill(m_active.begin(), m_active.end(), 0);
+}
+
+void ActiveTiles::markAll() {
+    std::fill(m_active.begin(), m_active.end(), 1);
+}
+
+void ActiveTiles::buildRegion() {
+    auto active = [this](int tx, int ty) {
+        return tx >= 0 && ty >= 0 && tx < (int) m_tilesX && ty < (int) m_tilesY && m_active[ty*m_tilesX + tx];
+    };
+
+    m_rowBegin = m_ny + 1;
+    m_rowEnd = 1;
+    for (uint32_t ty = 0; ty < m_tilesY; ++ty) {
+        // Columns of tiles that are active or touch one, diagonals included
+        int first = (int) m_tilesX, last = -1;
+        for (int tx = 0; tx < (int) m_tilesX; ++tx) {
+            bool inRegion = false;
+            for (int dy = -1; dy <= 1 && !inRegion; ++dy) {
+                for (int dx = -1; dx <= 1 && !inRegion; ++dx) inRegion = active(tx + dx, (int) ty + dy);
+            }
+            if (inRegion) {
+                first = std::min(first, tx);
+                last = tx;
+            }
+        }
+
+        if (last < 0) {
+            m_spanBegin[ty] = 1;
+            m_spanEnd[ty] = 0;
+            continue;
+        }
+        m_spanBegin[ty] = (uint32_t) first*TILE + 1;
+        m_spanEnd[ty] = std::min((uint32_t) (last + 1)*TILE, m_nx);
+        m_rowBegin = std::min(m_rowBegin, ty*TILE + 1);
+        m_rowEnd = std::min((ty + 1)*TILE, m_ny) + 1;
+    }
+    if (m_rowBegin > m_rowEnd) m_rowBegin = m_rowEnd;
+}
+
+uint32_t ActiveTiles::activeCount() const {
+    return (uint32_t) std::count(m_active.begin(), m_active.end(), 1);
+}
+
+uint32_t ActiveTiles::regionCount() const {
+    uint32_t count = 0;
+    for (uint32_t ty = 0; ty < m_tilesY; ++ty) {
+        if (m_spanBegin[ty] <= m_spanEnd[ty]) count += (m_spanEnd[ty] - m_spanBegin[ty])/TILE + 1;
+    }
+    return count;
+}
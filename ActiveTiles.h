@@ -0,0 +1,67 @@
+#ifndef ACTIVETILES_H
+#define ACTIVETILES_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Which TILE x TILE blocks of the interior hold any smoke or motion, so the
+// kernels can leave the idle parts of the grid alone. Idle tiles are exactly
+// zero in every field: a tile is cleared when it retires, and nothing writes
+// to it until it is marked again or enters the region next to an active one.
+//
+// The region a step works on is, per row of tiles, the span of columns from
+// the first to the last tile that is active or next to an active one. Spans
+// start on tile boundaries, which keeps the first column of a row odd.
+class ActiveTiles {
+public:
+    static constexpr uint32_t TILE = 16;
+
+    void resize(uint32_t nx, uint32_t ny);
+    void clear();
+    void markAll();
+    // Interior cell, 1-based like the solver fields
+    void mark(uint32_t i, uint32_t j) { m_active[((j - 1)/TILE)*m_tilesX + (i - 1)/TILE] = 1; }
+    bool active(uint32_t i, uint32_t j) const { return m_active[((j - 1)/TILE)*m_tilesX + (i - 1)/TILE] != 0; }
+
+    // Fixes the region of the next step from the active tiles
+    void buildRegion();
+    // Interior rows [rowBegin, rowEnd) holding the region
+    uint32_t rowBegin() const { return m_rowBegin; }
+    uint32_t rowEnd() const { return m_rowEnd; }
+    // Interior columns [begin, end] of row j inside the region, begin > end when there are none
+    void columns(uint32_t j, uint32_t& begin, uint32_t& end) const {
+        uint32_t t = (j - 1)/TILE;
+        begin = m_spanBegin[t];
+        end = m_spanEnd[t];
+    }
+
+    // After a step: tiles of the region stay active while maxAbs(i0, i1, j0, j1)
+    // over their cells (inclusive bounds) reaches threshold, the others are
+    // handed to retire(i0, i1, j0, j1) to be cleared.
+    template<class MaxAbs, class Retire>
+    void update(float threshold, MaxAbs&& maxAbs, Retire&& retire) {
+        for (uint32_t ty = 0; ty < m_tilesY; ++ty) {
+            if (m_spanBegin[ty] > m_spanEnd[ty]) continue;
+            uint32_t j0 = ty*TILE + 1, j1 = std::min(j0 + TILE - 1, m_ny);
+            for (uint32_t tx = (m_spanBegin[ty] - 1)/TILE; tx <= (m_spanEnd[ty] - 1)/TILE; ++tx) {
+                uint32_t i0 = tx*TILE + 1, i1 = std::min(i0 + TILE - 1, m_nx);
+                bool active = maxAbs(i0, i1, j0, j1) >= threshold;
+                m_active[ty*m_tilesX + tx] = active;
+                if (!active) retire(i0, i1, j0, j1);
+            }
+        }
+    }
+
+    uint32_t activeCount() const;
+    uint32_t regionCount() const;
+    uint32_t tileCount() const { return m_tilesX*m_tilesY; }
+
+private:
+    uint32_t m_nx = 0, m_ny = 0, m_tilesX = 0, m_tilesY = 0;
+    std::vector<uint8_t> m_active;
+    std::vector<uint32_t> m_spanBegin, m_spanEnd;
+    uint32_t m_rowBegin = 1, m_rowEnd = 1;
+};
+
+#endif //ACTIVETILES_H
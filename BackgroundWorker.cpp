@@ -0,0 +1,62 @@
+#include "BackgroundWorker.h"
+
+BackgroundWorker::BackgroundWorker() {
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+    m_thread = std::thread(&BackgroundWorker::loop, this);
+#endif
+}
+
+BackgroundWorker::~BackgroundWorker() {
+    if (!threaded()) return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+}
+
+void BackgroundWorker::run(Job job) {
+    if (!threaded()) {
+        job();
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this] { return !m_busy; });
+        m_job = std::move(job);
+        m_busy = true;
+    }
+    m_wake.notify_one();
+}
+
+void BackgroundWorker::wait() {
+    if (!threaded()) return;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return !m_busy; });
+}
+
+bool BackgroundWorker::busy() {
+    if (!threaded()) return false;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_busy;
+}
+
+void BackgroundWorker::loop() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this] { return m_stop || m_busy; });
+            // Pending work is finished before stopping
+            if (!m_busy) return;
+            job = std::move(m_job);
+        }
+        job();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_busy = false;
+        }
+        m_done.notify_all();
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef BACKGROUNDWORKER_H
+#define BACKGROUNDWORKER_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// One thread running one job at a time, for overlapping a whole solver step
+// with the caller's own work (rendering). Without threads the job runs inline
+// in run().
+class BackgroundWorker {
+public:
+    using Job = std::function<void()>;
+
+    BackgroundWorker();
+    BackgroundWorker(const BackgroundWorker &) = delete;
+    BackgroundWorker &operator=(const BackgroundWorker &) = delete;
+    ~BackgroundWorker();
+
+    // Waits for the previous job, then starts job and returns
+    void run(Job job);
+    // Returns once the last job has finished
+    void wait();
+    // Whether a job is still running, without waiting for it
+    bool busy();
+    bool threaded() const { return m_thread.joinable(); }
+
+private:
+    void loop();
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake, m_done;
+    Job m_job;
+    bool m_busy = false, m_stop = false;
+};
+
+#endif //BACKGROUNDWORKER_H
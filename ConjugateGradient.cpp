@@ -0,0 +1,333 @@
+#include "ConjugateGradient.h"
+#include "FluidKernels.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include <cmath>
+
+ConjugateGradient::Result ConjugateGradient::solve(const GridShape& shape, float* p, float* div, float tolerance,
+                                                   uint32_t maxIterations, ThreadPool* pool, bool useSimd,
+                                                   const Obstacles* obstacles) {
+    resize(shape);
+    m_pool = pool;
+    m_simd = FLUID_HAS_SIMD && useSimd;
+    m_walls = obstacles && !obstacles->empty() ? obstacles : nullptr;
+    if (m_factorTau != tau || m_factorSigma != sigma || m_factorWalls != m_walls
+        || (m_walls && m_factorVersion != m_walls->version())) {
+        factor();
+    }
+
+    const GridShape& s = m_shape;
+    FluidKernels<GridShape> kernels(s, m_pool, FluidSolver::LEXICOGRAPHIC, m_simd, nullptr, {}, m_walls);
+    FieldView<GridShape> b{div, s};
+
+    float mean = 0.0f;
+    if (m_walls) {
+        removeRegionMeans(div);
+    } else {
+        eachRow([&](uint32_t j) {
+            double sum = 0.0;
+            for (uint32_t i = 1; i <= s.nx; ++i) sum += b(i, j);
+            return sum;
+        });
+        mean = (float) (sumRows()/((double) s.nx*s.ny));
+    }
+    eachRow([&](uint32_t j) {
+        float maxAbs = 0.0f;
+        for (uint32_t i = 1; i <= s.nx; ++i) {
+            b(i, j) -= mean;
+            maxAbs = std::max(maxAbs, std::abs(b(i, j)));
+        }
+        return (double) maxAbs;
+    });
+    kernels.setBounds(div);
+    auto scale = (float) maxRow();
+    if (scale == 0.0f) return {0, 0.0f};
+
+    kernels.setBounds(p);
+    Result result{0, kernels.pressureResidual(p, div, m_r.data())/scale};
+    if (result.residual <= tolerance || maxIterations == 0) return result;
+
+    double rho = precondition();
+    m_s = m_z;
+    kernels.setBounds(m_s.data());
+    while (result.iterations < maxIterations) {
+        double qs = applyOperator();
+        if (qs <= 0.0) break;
+        auto alpha = (float) (rho/qs);
+        result.residual = (float) update(p, alpha)/scale;
+        result.iterations++;
+        if (result.residual <= tolerance) break;
+
+        double rhoNext = precondition();
+        auto beta = (float) (rhoNext/rho);
+        rho = rhoNext;
+        updateDirection(beta);
+        kernels.setBounds(m_s.data());
+    }
+    kernels.setBounds(p);
+    return result;
+}
+
+void ConjugateGradient::resize(const GridShape& shape) {
+    if (m_r.size() && m_shape.nx == shape.nx && m_shape.ny == shape.ny && m_shape.stride == shape.stride) return;
+    m_shape = shape;
+    for (Matrix<float>* m : {&m_precon, &m_r, &m_z, &m_s, &m_q}) m->resize(shape.nx + 2, shape.ny + 2);
+    m_rowSums.assign(shape.ny + 2, 0.0);
+    m_zeroRow.assign(shape.stride, 0.0f);
+    m_factorTau = m_factorSigma = -1.0f;
+}
+
+// Calls fn(jBegin, jEnd) for each block of rows, the blocks in parallel
+template<class F>
+void ConjugateGradient::forBlocks(F&& fn) {
+    uint32_t blocks = (m_shape.ny + BLOCK_ROWS - 1)/BLOCK_ROWS;
+    auto run = [&](uint32_t begin, uint32_t end, uint32_t) {
+        for (uint32_t block = begin; block < end; ++block) {
+            fn(1 + block*BLOCK_ROWS, std::min(1 + (block + 1)*BLOCK_ROWS, m_shape.ny + 1));
+        }
+    };
+    if (m_pool && blocks > 1 && m_shape.nx*m_shape.ny >= FluidKernels<GridShape>::MIN_PARALLEL_CELLS) {
+        m_pool->parallelFor(0, blocks, run);
+    } else {
+        run(0, blocks, 0);
+    }
+}
+
+// Stores row(j) for every interior row in m_rowSums, rows in parallel
+template<class F>
+void ConjugateGradient::eachRow(F&& row) {
+    FluidKernels<GridShape>(m_shape, m_pool, FluidSolver::LEXICOGRAPHIC, m_simd)
+        .forRows(1, m_shape.ny + 1, [&](uint32_t jBegin, uint32_t jEnd, uint32_t) {
+            for (uint32_t j = jBegin; j < jEnd; ++j) m_rowSums[j] = row(j);
+        });
+}
+
+double ConjugateGradient::sumRows() const {
+    double sum = 0.0;
+    for (uint32_t j = 1; j <= m_shape.ny; ++j) sum += m_rowSums[j];
+    return sum;
+}
+
+double ConjugateGradient::maxRow() const {
+    double maxValue = 0.0;
+    for (uint32_t j = 1; j <= m_shape.ny; ++j) maxValue = std::max(maxValue, m_rowSums[j]);
+    return maxValue;
+}
+
+// The operator's off-diagonal entries are all -1, so a cell's factor only
+// needs the factor of its left and lower neighbours within the block. Solid
+// cells keep a zero factor, which drops them from the substitutions too.
+void ConjugateGradient::factor() {
+    const GridShape& s = m_shape;
+    FieldView<GridShape> pc{m_precon.data(), s};
+    m_precon.fill(0.0f);
+    forBlocks([&](uint32_t jBegin, uint32_t jEnd) {
+        for (uint32_t j = jBegin; j < jEnd; ++j) {
+            bool down = j > jBegin, up = j + 1 < jEnd;
+            for (uint32_t i = 1; i <= s.nx; ++i) {
+                if (!fluid(i, j)) continue;
+                auto diag = (float) (fluid(i - 1, j) + fluid(i + 1, j) + fluid(i, j - 1) + fluid(i, j + 1));
+                // A cell walled in on all sides has no equation
+                if (diag == 0.0f) continue;
+                float e = diag;
+                if (fluid(i - 1, j)) {
+                    float l = pc(i - 1, j)*pc(i - 1, j);
+                    e -= up && fluid(i - 1, j + 1) ? l + tau*l : l;
+                }
+                if (down && fluid(i, j - 1)) {
+                    float d = pc(i, j - 1)*pc(i, j - 1);
+                    e -= fluid(i + 1, j - 1) ? d + tau*d : d;
+                }
+                if (e < sigma*diag) e = diag;
+                pc(i, j) = 1.0f/std::sqrt(e);
+            }
+        }
+    });
+    m_factorTau = tau;
+    m_factorSigma = sigma;
+    m_factorWalls = m_walls;
+    m_factorVersion = m_walls ? m_walls->version() : 0;
+    if (m_walls) labelRegions();
+}
+
+void ConjugateGradient::labelRegions() {
+    const GridShape& s = m_shape;
+    m_regions.assign((size_t) s.stride*(s.ny + 2), 0);
+    m_regionCells.assign(1, 0);
+    std::vector<uint32_t> stack;
+    for (uint32_t j = 1; j <= s.ny; ++j) {
+        for (uint32_t i = 1; i <= s.nx; ++i) {
+            if (!fluid(i, j) || m_regions[i + s.stride*j]) continue;
+            auto region = (uint32_t) m_regionCells.size();
+            m_regionCells.push_back(0);
+            m_regions[i + s.stride*j] = region;
+            stack.push_back(i + s.stride*j);
+            while (!stack.empty()) {
+                uint32_t index = stack.back();
+                stack.pop_back();
+                m_regionCells[region]++;
+                // The boundary ring is not fluid, so no step wraps to another row
+                for (uint32_t next : {index - 1, index + 1, index - s.stride, index + s.stride}) {
+                    if (fluid(next % s.stride, next/s.stride) && !m_regions[next]) {
+                        m_regions[next] = region;
+                        stack.push_back(next);
+                    }
+                }
+            }
+        }
+    }
+    m_regionSums.assign(m_regionCells.size(), 0.0);
+}
+
+void ConjugateGradient::removeRegionMeans(float* xp) {
+    const GridShape& s = m_shape;
+    FieldView<GridShape> x{xp, s};
+    std::fill(m_regionSums.begin(), m_regionSums.end(), 0.0);
+    for (uint32_t j = 1; j <= s.ny; ++j) {
+        for (uint32_t i = 1; i <= s.nx; ++i) m_regionSums[m_regions[i + s.stride*j]] += x(i, j);
+    }
+    for (size_t region = 1; region < m_regionSums.size(); ++region) m_regionSums[region] /= m_regionCells[region];
+    for (uint32_t j = 1; j <= s.ny; ++j) {
+        for (uint32_t i = 1; i <= s.nx; ++i) {
+            uint32_t region = m_regions[i + s.stride*j];
+            x(i, j) = region ? x(i, j) - (float) m_regionSums[region] : 0.0f;
+        }
+    }
+}
+
+// Forward then backward substitution through the block's factor, in place
+// in z: the backward sweep reads a cell's forward value before replacing it.
+// The factor products come first, so each cell waits on one multiply-add.
+double ConjugateGradient::precondition() {
+    const GridShape& s = m_shape;
+    FieldView<GridShape> z{m_z.data(), s}, pc{m_precon.data(), s}, r{m_r.data(), s};
+    const float* zero = m_zeroRow.data();
+    forBlocks([&](uint32_t jBegin, uint32_t jEnd) {
+        for (uint32_t j = jBegin; j < jEnd; ++j) {
+            float* zRow = &z(0, j);
+            const float* pcRow = &pc(0, j);
+            const float* rRow = &r(0, j);
+            const float* zBelow = j > jBegin ? &z(0, j - 1) : zero;
+            const float* pcBelow = j > jBegin ? &pc(0, j - 1) : zero;
+            for (uint32_t i = 1; i <= s.nx; ++i) {
+                zRow[i] = (rRow[i] + pcBelow[i]*zBelow[i])*pcRow[i] + pcRow[i - 1]*pcRow[i]*zRow[i - 1];
+            }
+        }
+        for (uint32_t j = jEnd; j-- > jBegin;) {
+            float* zRow = &z(0, j);
+            const float* pcRow = &pc(0, j);
+            const float* zAbove = j + 1 < jEnd ? &z(0, j + 1) : zero;
+            double dot = 0.0;
+            for (uint32_t i = s.nx; i >= 1; --i) {
+                zRow[i] = (zRow[i] + pcRow[i]*zAbove[i])*pcRow[i] + pcRow[i]*pcRow[i]*zRow[i + 1];
+                dot += (double) zRow[i]*r(i, j);
+            }
+            m_rowSums[j] = dot;
+        }
+    });
+    if (m_walls) {
+        removeRegionMeans(m_z.data());
+        eachRow([&](uint32_t j) {
+            double dot = 0.0;
+            for (uint32_t i = 1; i <= s.nx; ++i) dot += (double) z(i, j)*r(i, j);
+            return dot;
+        });
+    }
+    return sumRows();
+}
+
+double ConjugateGradient::applyOperator() {
+    const GridShape& s = m_shape;
+    FieldView<GridShape> q{m_q.data(), s}, d{m_s.data(), s};
+    eachRow([&](uint32_t j) {
+        uint32_t i = 1;
+#if FLUID_HAS_SIMD
+        if (m_simd) {
+            using namespace simd;
+            const F four = set1(4.0f);
+            for (; i + WIDTH - 1 <= s.nx; i += WIDTH) {
+                F sum = sub(sub(mul(four, load(&d(i, j))), load(&d(i + 1, j))), load(&d(i - 1, j)));
+                store(&q(i, j), sub(sub(sum, load(&d(i, j + 1))), load(&d(i, j - 1))));
+            }
+        }
+#endif
+        for (; i <= s.nx; ++i) {
+            q(i, j) = 4*d(i, j) - d(i + 1, j) - d(i - 1, j) - d(i, j + 1) - d(i, j - 1);
+        }
+        if (m_walls) {
+            // Solid neighbours read as the cell itself cancel out of its row
+            for (const Obstacles::Cell* cell = m_walls->rowBegin(j); cell != m_walls->rowEnd(j); ++cell) {
+                i = cell->index - s.stride*j;
+                if (cell->code & Obstacles::SOLID) {
+                    q(i, j) = 0.0f;
+                    continue;
+                }
+                float v = 4*d(i, j);
+                v -= cell->code & Obstacles::RIGHT ? d(i, j) : d(i + 1, j);
+                v -= cell->code & Obstacles::LEFT ? d(i, j) : d(i - 1, j);
+                v -= cell->code & Obstacles::UP ? d(i, j) : d(i, j + 1);
+                v -= cell->code & Obstacles::DOWN ? d(i, j) : d(i, j - 1);
+                q(i, j) = v;
+            }
+        }
+        double dot = 0.0;
+        for (i = 1; i <= s.nx; ++i) dot += (double) q(i, j)*d(i, j);
+        return dot;
+    });
+    return sumRows();
+}
+
+// p += alpha s, r -= alpha q, returns max |r|
+double ConjugateGradient::update(float* pp, float alpha) {
+    const GridShape& s = m_shape;
+    FieldView<GridShape> p{pp, s}, r{m_r.data(), s}, q{m_q.data(), s}, d{m_s.data(), s};
+    eachRow([&](uint32_t j) {
+        uint32_t i = 1;
+        float maxAbs = 0.0f;
+#if FLUID_HAS_SIMD
+        if (m_simd) {
+            using namespace simd;
+            const F a = set1(alpha);
+            F m = set1(0.0f);
+            for (; i + WIDTH - 1 <= s.nx; i += WIDTH) {
+                store(&p(i, j), add(load(&p(i, j)), mul(a, load(&d(i, j)))));
+                F ri = sub(load(&r(i, j)), mul(a, load(&q(i, j))));
+                store(&r(i, j), ri);
+                m = max(m, abs(ri));
+            }
+            alignas(32) float lanes[WIDTH];
+            store(lanes, m);
+            for (float lane : lanes) maxAbs = std::max(maxAbs, lane);
+        }
+#endif
+        for (; i <= s.nx; ++i) {
+            p(i, j) += alpha*d(i, j);
+            r(i, j) -= alpha*q(i, j);
+            maxAbs = std::max(maxAbs, std::abs(r(i, j)));
+        }
+        return (double) maxAbs;
+    });
+    return maxRow();
+}
+
+// s = z + beta s
+void ConjugateGradient::updateDirection(float beta) {
+    const GridShape& s = m_shape;
+    FieldView<GridShape> z{m_z.data(), s}, d{m_s.data(), s};
+    eachRow([&](uint32_t j) {
+        uint32_t i = 1;
+#if FLUID_HAS_SIMD
+        if (m_simd) {
+            using namespace simd;
+            const F b = set1(beta);
+            for (; i + WIDTH - 1 <= s.nx; i += WIDTH) {
+                store(&d(i, j), add(load(&z(i, j)), mul(b, load(&d(i, j)))));
+            }
+        }
+#endif
+        for (; i <= s.nx; ++i) {
+            d(i, j) = z(i, j) + beta*d(i, j);
+        }
+        return 0.0;
+    });
+}
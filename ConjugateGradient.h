@@ -0,0 +1,81 @@
+#ifndef CONJUGATEGRADIENT_H
+#define CONJUGATEGRADIENT_H
+
+#include "GridShape.h"
+#include "Matrix.h"
+#include "Obstacles.h"
+#include <vector>
+
+class ThreadPool;
+
+// Matrix-free preconditioned conjugate gradient for the pressure problem
+// Multigrid solves. The preconditioner is modified incomplete Cholesky,
+// MIC(0), factored per block of BLOCK_ROWS rows so the blocks' triangular
+// solves run in parallel. Dot products add up per-row partial sums in row
+// order, so the result does not depend on the thread count. Solid cells are
+// left out of the system: their fluid neighbours have Neumann rows, with the
+// solid side dropped from both the stencil and the diagonal. Each region the
+// walls seal off then has its own constant null space, which is projected out
+// of the right-hand side and of every preconditioned residual.
+class ConjugateGradient {
+public:
+    struct Result {
+        uint32_t iterations;
+        float residual; // max |div - A p| relative to max |div|
+    };
+
+    static constexpr uint32_t BLOCK_ROWS = 32;
+
+    // Solves in place starting from the given p, so last step's pressure is
+    // a warm start. The mean of div is removed first, as with Multigrid.
+    Result solve(const GridShape& shape, float* p, float* div, float tolerance, uint32_t maxIterations,
+                 ThreadPool* pool = nullptr, bool useSimd = true, const Obstacles* obstacles = nullptr);
+
+    // MIC(0) blends tau of the dropped fill-in back into the diagonal and
+    // falls back to the plain diagonal for pivots below sigma of it
+    float tau = 0.97f, sigma = 0.25f;
+
+private:
+    void resize(const GridShape& shape);
+    void factor();
+    // Interior cell that is not solid
+    bool fluid(uint32_t i, uint32_t j) const {
+        return i >= 1 && i <= m_shape.nx && j >= 1 && j <= m_shape.ny && !(m_walls && m_walls->solid(i, j));
+    }
+    // z = M^-1 r, returns the dot product of z and r
+    double precondition();
+    // q = A s, returns the dot product of q and s
+    double applyOperator();
+    // Numbers the connected fluid regions of m_walls in m_regions
+    void labelRegions();
+    // Subtracts from x its mean over each region and zeroes the solid cells
+    void removeRegionMeans(float* x);
+    double update(float* p, float alpha);
+    void updateDirection(float beta);
+
+    template<class F> void forBlocks(F&& fn);
+    template<class F> void eachRow(F&& row);
+    double sumRows() const;
+    double maxRow() const;
+
+    GridShape m_shape{};
+    float m_factorTau = 0.0f, m_factorSigma = 0.0f;
+    // The mask the factor was built for, null without solid cells
+    const Obstacles* m_walls = nullptr;
+    const Obstacles* m_factorWalls = nullptr;
+    uint32_t m_factorVersion = 0;
+    ThreadPool* m_pool = nullptr;
+    bool m_simd = true;
+    // Inverse square roots of the factor's diagonal, zero on the boundary ring
+    // and in solid cells
+    Matrix<float> m_precon;
+    Matrix<float> m_r, m_z, m_s, m_q;
+    std::vector<double> m_rowSums;
+    // Region of each cell, 0 for solid ones and the boundary ring, and the
+    // number of cells and running sum of each region
+    std::vector<uint32_t> m_regions, m_regionCells;
+    std::vector<double> m_regionSums;
+    std::vector<float> m_zeroRow;
+};
+
+#endif //CONJUGATEGRADIENT_H
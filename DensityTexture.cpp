@@ -0,0 +1,191 @@
+#include "DensityTexture.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef __EMSCRIPTEN__
+// WebGL 1 has neither GL_RED textures nor GL_UNPACK_ROW_LENGTH
+static constexpr GLint R8_INTERNAL_FORMAT = GL_LUMINANCE;
+static constexpr GLenum R8_FORMAT = GL_LUMINANCE;
+#else
+static constexpr GLint R8_INTERNAL_FORMAT = GL_R8;
+static constexpr GLenum R8_FORMAT = GL_RED;
+#endif
+
+void DensityTexture::create(uint32_t width, uint32_t height, Format format) {
+    m_width = width;
+    m_height = height;
+#ifdef __EMSCRIPTEN__
+    format = R8;
+#endif
+    m_format = format;
+    m_blended.assign(width, 0.0f);
+#ifdef __EMSCRIPTEN__
+    m_staging.assign(uploadBytes(), 0);
+#endif
+
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    // Linear filtering between texel centres shades like the per-vertex colours of the mesh
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (m_format == R8) {
+        glTexImage2D(GL_TEXTURE_2D, 0, R8_INTERNAL_FORMAT, (GLsizei) width, (GLsizei) height, 0, R8_FORMAT,
+                     GL_UNSIGNED_BYTE, nullptr);
+    } else {
+#ifndef __EMSCRIPTEN__
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, (GLsizei) width, (GLsizei) height, 0, GL_RED, GL_FLOAT, nullptr);
+#endif
+    }
+
+#ifndef __EMSCRIPTEN__
+    auto bytes = (GLsizeiptr) uploadBytes();
+    m_persistent = GLAD_GL_VERSION_4_4 != 0;
+    m_nextBuffer = 0;
+    glGenBuffers(UPLOAD_BUFFERS, m_uploadBuffers);
+    for (uint32_t k = 0; k < UPLOAD_BUFFERS; ++k) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_uploadBuffers[k]);
+        if (m_persistent) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, flags);
+            m_mapped[k] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, flags);
+        } else {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+#endif
+
+    // Corners sit on the centres of the corner texels, like the mesh vertices on the border cells
+    float u0 = 0.5f/(float) width, u1 = 1.0f - u0;
+    float v0 = 0.5f/(float) height, v1 = 1.0f - v0;
+    const GLfloat quad[] = {
+            -1.0f, -1.0f, u0, v0,
+             1.0f, -1.0f, u1, v0,
+            -1.0f,  1.0f, u0, v1,
+             1.0f,  1.0f, u1, v1,
+    };
+
+    glGenVertexArrays(1, &VAO);
+    glBindVertexArray(VAO);
+
+    glGenBuffers(1, &VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+
+    // position
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4*sizeof(GLfloat), (void*)0);
+    // texture coordinates
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4*sizeof(GLfloat), (void*)(2*sizeof(GLfloat)));
+}
+
+void DensityTexture::deleteBuffers() {
+#ifndef __EMSCRIPTEN__
+    for (uint32_t k = 0; k < UPLOAD_BUFFERS; ++k) {
+        if (m_fences[k]) glDeleteSync(m_fences[k]);
+        m_fences[k] = nullptr;
+        if (m_mapped[k]) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_uploadBuffers[k]);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            m_mapped[k] = nullptr;
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(UPLOAD_BUFFERS, m_uploadBuffers);
+#endif
+    glDeleteTextures(1, &m_texture);
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+}
+
+void DensityTexture::update(const float* density, uint32_t stride, const float* previous, float alpha) {
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    GLenum format = m_format == R8 ? R8_FORMAT : GL_RED;
+    GLenum type = m_format == R8 ? GL_UNSIGNED_BYTE : GL_FLOAT;
+#ifdef __EMSCRIPTEN__
+    fill(density, previous, alpha, stride, m_staging.data());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei) m_width, (GLsizei) m_height, format, type, m_staging.data());
+#else
+    uint32_t k = m_nextBuffer;
+    m_nextBuffer = (m_nextBuffer + 1) % UPLOAD_BUFFERS;
+    if (m_fences[k]) {
+        // Polled, never waited on: the render thread must not stall on a GPU
+        // that is UPLOAD_BUFFERS frames behind
+        GLenum status = glClientWaitSync(m_fences[k], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            // The GPU may still be reading the buffer; it keeps its fence
+            // and this frame goes up from client memory instead
+            uploadDirect(density, stride, previous, alpha, format, type);
+            return;
+        }
+        glDeleteSync(m_fences[k]);
+        m_fences[k] = nullptr;
+        if (status == GL_WAIT_FAILED) {
+            uploadDirect(density, stride, previous, alpha, format, type);
+            return;
+        }
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_uploadBuffers[k]);
+    if (m_persistent) {
+        fill(density, previous, alpha, stride, m_mapped[k]);
+    } else {
+        void* out = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr) uploadBytes(),
+                                     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (!out) {
+            uploadDirect(density, stride, previous, alpha, format, type);
+            return;
+        }
+        fill(density, previous, alpha, stride, out);
+        if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+            // The store was lost (e.g. a display mode change), so is what we wrote
+            uploadDirect(density, stride, previous, alpha, format, type);
+            return;
+        }
+    }
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei) m_width, (GLsizei) m_height, format, type, nullptr);
+    m_fences[k] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+#endif
+}
+
+#ifndef __EMSCRIPTEN__
+void DensityTexture::uploadDirect(const float* density, uint32_t stride, const float* previous, float alpha,
+                                  GLenum format, GLenum type) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    m_staging.resize(uploadBytes());
+    fill(density, previous, alpha, stride, m_staging.data());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei) m_width, (GLsizei) m_height, format, type, m_staging.data());
+}
+#endif
+
+void DensityTexture::fill(const float* density, const float* previous, float alpha, uint32_t stride, void* out) {
+    for (uint32_t j = 0; j < m_height; ++j) {
+        const float* row = density + (size_t) stride*j;
+        if (previous) {
+            const float* before = previous + (size_t) stride*j;
+            for (uint32_t i = 0; i < m_width; ++i) m_blended[i] = before[i] + alpha*(row[i] - before[i]);
+            row = m_blended.data();
+        }
+        if (m_format == R8) {
+            uint8_t* texels = (uint8_t*) out + (size_t) m_width*j;
+            for (uint32_t i = 0; i < m_width; ++i) {
+                texels[i] = (uint8_t) (std::min(std::max(row[i], 0.0f), 1.0f)*255.0f + 0.5f);
+            }
+        } else {
+            // The driver converts to half floats
+            std::memcpy((float*) out + (size_t) m_width*j, row, m_width*sizeof(float));
+        }
+    }
+}
+
+void DensityTexture::render() {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glBindVertexArray(VAO);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
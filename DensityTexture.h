@@ -0,0 +1,74 @@
+#ifndef DENSITYTEXTURE_H
+#define DENSITYTEXTURE_H
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#define GL_GLEXT_PROTOTYPES
+#define EGL_EGLEXT_PROTOTYPES
+#else
+#include "external/glad.h"
+#endif
+#include <GLFW/glfw3.h>
+#include <cstdint>
+#include <vector>
+
+// Draws the density field as a single channel texture on one fullscreen quad.
+// Only the density goes over the bus: one byte per cell for R8 against the
+// 24 bytes per vertex of Grid2D, and no vertex or index count limit.
+//
+// On desktop GL uploads go through a ring of pixel buffers, persistently
+// mapped when the context has buffer storage (GL 4.4) and mapped
+// unsynchronised otherwise; a fence per buffer keeps the CPU from writing one
+// the GPU has not copied from yet. A buffer whose fence has not signalled is
+// skipped and that frame is uploaded from client memory, so the render thread
+// never waits on the GPU. WebGL uploads from client memory.
+class DensityTexture {
+
+public:
+    enum Format {
+        R8,  // quantised on the CPU, works everywhere
+        R16F // floats handed to the driver as they are, desktop GL only
+    };
+
+    static constexpr uint32_t UPLOAD_BUFFERS = 3;
+
+    DensityTexture() = default;
+    DensityTexture(const DensityTexture &) = delete;
+    DensityTexture &operator=(const DensityTexture &) = delete;
+    ~DensityTexture() = default;
+
+    // One texel per cell, borders included
+    void create(uint32_t width, uint32_t height, Format format = R8);
+    void deleteBuffers();
+    // density rows are stride floats apart. With previous set, uploads
+    // previous + alpha*(density - previous) instead.
+    void update(const float* density, uint32_t stride, const float* previous = nullptr, float alpha = 1.0f);
+    // Expects a program sampling texture unit 0 with the quad position at attribute 0
+    void render();
+    Format format() const { return m_format; }
+    size_t uploadBytes() const { return (size_t) m_width*m_height*(m_format == R8 ? 1 : sizeof(float)); }
+
+private:
+    void fill(const float* density, const float* previous, float alpha, uint32_t stride, void* out);
+#ifndef __EMSCRIPTEN__
+    // Upload from m_staging, for frames whose upload buffer cannot be used
+    void uploadDirect(const float* density, uint32_t stride, const float* previous, float alpha, GLenum format,
+                      GLenum type);
+#endif
+
+    uint32_t m_width = 0, m_height = 0;
+    Format m_format = R8;
+    std::vector<uint8_t> m_staging; // WebGL, and native frames that skip the upload buffers
+    std::vector<float> m_blended;   // one interpolated row
+    GLuint m_texture{}, VBO{}, VAO{};
+#ifndef __EMSCRIPTEN__
+    GLuint m_uploadBuffers[UPLOAD_BUFFERS]{};
+    GLsync m_fences[UPLOAD_BUFFERS]{};
+    void* m_mapped[UPLOAD_BUFFERS]{};
+    uint32_t m_nextBuffer = 0;
+    bool m_persistent = false;
+#endif
+};
+
+
+#endif //DENSITYTEXTURE_H
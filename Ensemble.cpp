@@ -0,0 +1,69 @@
+#include "Ensemble.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+
+Ensemble::Ensemble(uint32_t cellsX, uint32_t cellsY): m_cellsX(cellsX), m_cellsY(cellsY) {}
+
+Ensemble::~Ensemble() = default;
+
+FluidSolver& Ensemble::add(const Params& params) {
+    Instance instance;
+    instance.params = params;
+    instance.solver = std::make_unique<FluidSolver>(m_cellsX, m_cellsY);
+    instance.solver->viscosity = params.viscosity;
+    instance.solver->diffusionFactor = params.diffusionFactor;
+    instance.solver->dissolveFactor = params.dissolveFactor;
+    m_instances.push_back(std::move(instance));
+    return *m_instances.back().solver;
+}
+
+void Ensemble::setThreadCount(uint32_t threadCount) {
+    if (threadCount == this->threadCount()) return;
+    m_pool = threadCount > 1 ? std::make_unique<ThreadPool>(threadCount) : nullptr;
+}
+
+uint32_t Ensemble::threadCount() const {
+    return m_pool ? m_pool->size() : 1;
+}
+
+void Ensemble::step(float deltaTime, const Forces& forces) {
+    // Instances take differently long (sparse tiles, substeps), so threads
+    // pull the next one instead of owning a fixed share. Each instance only
+    // touches its own solver, which keeps the results independent of the
+    // thread count.
+    std::atomic<uint32_t> next{0};
+    auto run = [&](uint32_t, uint32_t, uint32_t) {
+        simd::DenormalScope denormals;
+        for (uint32_t k = next++; k < size(); k = next++) {
+            Instance& instance = m_instances[k];
+            auto start = std::chrono::steady_clock::now();
+            if (forces) forces(k, *instance.solver, instance.params);
+            instance.steps += instance.solver->advance(deltaTime);
+            instance.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    };
+    if (m_pool) m_pool->parallelFor(0, m_pool->size(), run);
+    else run(0, 1, 0);
+}
+
+Ensemble::Output Ensemble::output(uint32_t instance) const {
+    const Instance& in = m_instances[instance];
+    // A fixed point density is read through its float copy
+    in.solver->unpackDensity();
+    const FluidSolver::FluidData& state = in.solver->curState;
+    Output out;
+    out.steps = in.steps;
+    out.seconds = in.seconds;
+    for (uint32_t j = 1; j <= m_cellsY; ++j) {
+        for (uint32_t i = 1; i <= m_cellsX; ++i) {
+            out.totalDensity += state.density(i, j);
+            out.maxDensity = std::max(out.maxDensity, state.density(i, j));
+            out.maxSpeed = std::max(out.maxSpeed, std::hypot(state.velX(i, j), state.velY(i, j)));
+        }
+    }
+    return out;
+}
@@ -0,0 +1,68 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include "FluidSolver.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class ThreadPool;
+
+// Independent solvers of one grid size stepped together, for parameter
+// sweeps in a single process. Each instance runs the single-threaded
+// kernels and whole instances are spread over the threads, so small grids
+// stay in the cache of the core stepping them and no step waits on another.
+class Ensemble {
+public:
+    // What a sweep varies; initialSpeed scales the velocity the forces inject
+    struct Params {
+        float viscosity = 0.005f, diffusionFactor = 0.001f, dissolveFactor = 0.02f;
+        float initialSpeed = 1.0f;
+    };
+
+    struct Output {
+        double totalDensity = 0.0;
+        float maxDensity = 0.0f, maxSpeed = 0.0f;
+        uint64_t steps = 0; // solver steps, CFL substeps included
+        double seconds = 0.0;
+    };
+
+    // Called for each instance before its step, on the thread stepping it
+    using Forces = std::function<void(uint32_t instance, FluidSolver& solver, const Params& params)>;
+
+    Ensemble(uint32_t cellsX, uint32_t cellsY);
+    Ensemble(const Ensemble &) = delete;
+    Ensemble &operator=(const Ensemble &) = delete;
+    ~Ensemble();
+
+    // Adds an instance with the given parameters and returns its solver for
+    // any further configuration
+    FluidSolver& add(const Params& params);
+    uint32_t size() const { return (uint32_t) m_instances.size(); }
+    FluidSolver& solver(uint32_t instance) { return *m_instances[instance].solver; }
+    const Params& params(uint32_t instance) const { return m_instances[instance].params; }
+
+    // Threads stepping instances, the caller included
+    void setThreadCount(uint32_t threadCount);
+    uint32_t threadCount() const;
+
+    // Applies forces and advances every instance by deltaTime
+    void step(float deltaTime, const Forces& forces = {});
+    // Density and speed statistics of an instance's current state
+    Output output(uint32_t instance) const;
+
+private:
+    struct Instance {
+        Params params;
+        std::unique_ptr<FluidSolver> solver;
+        uint64_t steps = 0;
+        double seconds = 0.0;
+    };
+
+    uint32_t m_cellsX, m_cellsY;
+    std::vector<Instance> m_instances;
+    std::unique_ptr<ThreadPool> m_pool;
+};
+
+#endif //ENSEMBLE_H
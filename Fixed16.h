@@ -0,0 +1,39 @@
+#ifndef FIXED16_H
+#define FIXED16_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// 16-bit fixed point density: the code is sqrt(value/4) scaled to 0..65535,
+// so values in [0, 4] are held with a step of about 6e-5 at 1 and 1e-9
+// near zero. Dissolve clamps density to [0, 2] every step, the
+// headroom keeps what is added between steps. A linear code loses the thin
+// edge of spreading smoke: diffusion rounds it to zero cell by cell.
+// Packing rounds to nearest and saturates; every code unpacks to a value
+// that packs back to it.
+namespace fixed16 {
+    constexpr float MAX = 4.0f;
+
+    inline uint16_t fromFloat(float value) {
+        // Negated test so NaN packs to zero
+        if (!(value > 0.0f)) return 0;
+        if (value >= MAX) return 0xffffu;
+        return (uint16_t) (std::sqrt(value*(1.0f/MAX))*65535.0f + 0.5f);
+    }
+
+    inline float toFloat(uint16_t code) {
+        float root = (float) code*(1.0f/65535.0f);
+        return MAX*root*root;
+    }
+
+    inline void pack(const float* in, uint16_t* out, size_t count) {
+        for (size_t k = 0; k < count; ++k) out[k] = fromFloat(in[k]);
+    }
+
+    inline void unpack(const uint16_t* in, float* out, size_t count) {
+        for (size_t k = 0; k < count; ++k) out[k] = toFloat(in[k]);
+    }
+}
+
+#endif //FIXED16_H
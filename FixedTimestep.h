@@ -0,0 +1,46 @@
+#ifndef FIXEDTIMESTEP_H
+#define FIXEDTIMESTEP_H
+
+#include <algorithm>
+#include <cstdint>
+
+// Turns wall-clock frame times into a whole number of fixed solver steps.
+// Leftover time carries over to the next frame, and alpha() tells how far
+// the display is between the last two solver states.
+class FixedTimestep {
+public:
+    explicit FixedTimestep(float stepRate = 60.0f, uint32_t maxSteps = 4): maxSteps(maxSteps) {
+        setStepRate(stepRate);
+    }
+
+    void setStepRate(float stepRate) { m_stepSize = 1.0f/std::max(stepRate, 1.0f); }
+    void setStepSize(float stepSize) { m_stepSize = std::min(std::max(stepSize, 1e-4f), 1.0f); }
+    float stepSize() const { return m_stepSize; }
+
+    // Steps to run for a frame that took elapsed seconds. Time beyond
+    // maxSteps steps is dropped, so a stall costs one slow frame rather than
+    // a spiral of ever longer catch-ups.
+    uint32_t advance(float elapsed) {
+        m_accumulator += std::max(elapsed, 0.0f);
+        auto steps = (uint32_t) std::min(m_accumulator/m_stepSize, (float) maxSteps);
+        m_accumulator -= (float) steps*m_stepSize;
+        if (m_accumulator >= m_stepSize) {
+            auto dropped = (uint32_t) (m_accumulator/m_stepSize);
+            m_droppedSteps += dropped;
+            m_accumulator -= (float) dropped*m_stepSize;
+        }
+        return steps;
+    }
+
+    float alpha() const { return std::min(m_accumulator/m_stepSize, 1.0f); }
+    uint64_t droppedSteps() const { return m_droppedSteps; }
+
+    uint32_t maxSteps;
+
+private:
+    float m_stepSize = 1.0f/60.0f;
+    float m_accumulator = 0.0f;
+    uint64_t m_droppedSteps = 0;
+};
+
+#endif //FIXEDTIMESTEP_H
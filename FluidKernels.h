@@ -0,0 +1,1004 @@
+#ifndef FLUIDKERNELS_H
+#define FLUIDKERNELS_H
+
+#include "ActiveTiles.h"
+#include "Fixed16.h"
+#include "FluidSolver.h"
+#include "GridShape.h"
+#include "Obstacles.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// Solver stages written once against a shape; FluidSolver instantiates them
+// for its fixed fast path and for runtime-sized grids.
+//
+// Row loops are split into bands on the thread pool when one is given and
+// the grid is big enough to pay for the hand-off. Lexicographic Gauss-Seidel
+// always runs serially; red-black relaxation updates one colour at a time,
+// so its result does not depend on the number of threads.
+//
+// With SIMD enabled, advection, the red-black sweeps and the divergence,
+// gradient and dissolve loops process simd::WIDTH cells at a time and
+// finish each row with the scalar code. The vector code evaluates the same
+// expressions in the same order, so both paths agree bit for bit.
+//
+// Given an ActiveTiles region, the interior loops only visit its rows and
+// column spans; boundaries, dissolve and the reductions still cover the grid.
+// Given Obstacles, setBounds also enforces the walls inside the grid.
+//
+// MacCormack and BFECC advection run a forward and a backward backtrace into
+// scratch fields, then a limited pass that clamps the corrected value to the
+// four source cells the backtrace lands between, so the higher order never
+// creates new extrema. Monotonic cubic interpolation has no vector version.
+// Without scratch fields (two per advected field) advection stays semi-Lagrangian
+//
+// Density kept in 16-bit fixed point (Fixed16.h) goes through diffusePacked,
+// advectPacked and the dissolve, setBounds and applyForces templates; they
+// unpack cells to float for the arithmetic, pack what they write and only
+// have scalar loops.
+struct AdvectionSettings {
+    FluidSolver::AdvectionScheme scheme = FluidSolver::SEMI_LAGRANGIAN;
+    FluidSolver::Interpolation interpolation = FluidSolver::BILINEAR;
+    std::array<float*, 4> scratch{};
+};
+
+template<class Shape>
+class FluidKernels {
+public:
+    using BoundConfig = FluidSolver::BoundConfig;
+    using RelaxOrder = FluidSolver::RelaxOrder;
+    using View = FieldView<Shape, float>;
+    using ConstView = FieldView<Shape, const float>;
+
+    static constexpr uint32_t MIN_PARALLEL_CELLS = 16384;
+    // Cache a blocked relaxation aims its window of rows at
+    static constexpr size_t BLOCK_BYTES = 1 << 20;
+    using Advection = AdvectionSettings;
+
+#if FLUID_HAS_SIMD
+    // One vector per relaxed field (std::array would drop the vector type's alignment attributes)
+    template<size_t N>
+    struct Lanes {
+        simd::F v[N];
+        simd::F& operator[](size_t c) { return v[c]; }
+        const simd::F& operator[](size_t c) const { return v[c]; }
+    };
+#endif
+
+    explicit FluidKernels(Shape shape, ThreadPool* pool = nullptr, RelaxOrder order = FluidSolver::LEXICOGRAPHIC,
+                          bool useSimd = true, const ActiveTiles* region = nullptr, const Advection& advection = {},
+                          const Obstacles* obstacles = nullptr, bool blockSweeps = false)
+        : s(shape), m_pool(pool), m_order(order), m_simd(FLUID_HAS_SIMD && useSimd), m_region(region),
+          m_advection(advection), m_obstacles(obstacles), m_blockSweeps(blockSweeps) {}
+
+    void diffuse(float* xp, const float* x0p, float diff, float dt) const {
+        diffuseFields<1>({xp}, {x0p}, diff, dt);
+    }
+
+    // Both velocity components in one pass per sweep instead of one pass each
+    void diffuseVelocity(float* velXp, float* velYp, const float* velX0p, const float* velY0p, float diff, float dt) const {
+        diffuseFields<2>({velXp, velYp}, {velX0p, velY0p}, diff, dt);
+    }
+
+    // dissolve and color are optional, see advectFields
+    void advect(float* dp, const float* d0p, const float* velXp, const float* velYp, float dt, BoundConfig b,
+                const float* dissolve = nullptr, const FluidSolver::ColorTarget* color = nullptr) const {
+        advectFields<1>({dp}, {d0p}, {b}, velXp, velYp, dt, dissolve, color);
+    }
+
+    // diffuse and semi-Lagrangian, bilinear advect of a 16-bit fixed point density
+    void diffusePacked(uint16_t* xp, const uint16_t* x0p, float diff, float dt) const {
+        float a = dt*diff*(float)(s.ny*s.nx);
+        FieldView<Shape, uint16_t> x{xp, s};
+        FieldView<Shape, const uint16_t> x0{x0p, s};
+        relax(std::array<uint16_t*, 1>{xp}, 20, [&](uint32_t i, uint32_t j, uint8_t solid) {
+            float sum = valueOf(neighbour<Obstacles::LEFT>(x, i, j, solid)) + valueOf(neighbour<Obstacles::RIGHT>(x, i, j, solid))
+                        + valueOf(neighbour<Obstacles::DOWN>(x, i, j, solid)) + valueOf(neighbour<Obstacles::UP>(x, i, j, solid));
+            setValue(x(i,j), (valueOf(x0(i,j)) + a*sum)/(1+4*a));
+        });
+    }
+
+    void advectPacked(uint16_t* dp, const uint16_t* d0p, const float* velXp, const float* velYp, float dt,
+                      const float* dissolve = nullptr, const FluidSolver::ColorTarget* color = nullptr) const {
+        std::array<uint16_t*, 1> ds{dp};
+        std::array<const uint16_t*, 1> d0s{d0p};
+        std::array<BoundConfig, 1> bounds{FluidSolver::REGULAR};
+        backtraceFields<1>(ds, d0s, bounds, velXp, velYp, dt, dissolve, color);
+        if (m_obstacles) advectEdges<1>(ds, d0s, bounds, velXp, velYp, dt, dissolve, color);
+    }
+
+    // Advects both velocity components along the velocity they were in, sharing one backtrace per cell
+    void advectVelocity(float* velXp, float* velYp, const float* velX0p, const float* velY0p, float dt) const {
+        advectFields<2>({velXp, velYp}, {velX0p, velY0p}, {FluidSolver::MIRROR_X, FluidSolver::MIRROR_Y},
+                        velX0p, velY0p, dt, nullptr, nullptr);
+    }
+
+    // Vorticity confinement and buoyancy in one pass: reads the velocity and
+    // density, writes the forced velocity to outX/outY. Confinement pushes
+    // along N x curl, N the normalised gradient of |curl|, with strength
+    // vorticity*h; buoyancy accelerates upwards by buoyancy*density. Each
+    // band keeps the curl of three rows, computed a row ahead of the force,
+    // so the curl never goes through memory and bands never share a row.
+    // A 16-bit fixed point density is read by the scalar code.
+    template<class D>
+    void applyForces(const float* velXp, const float* velYp, const D* densityp, float* outXp, float* outYp,
+                     float dt, float vorticity, float buoyancy) const {
+        ConstView velX{velXp, s}, velY{velYp, s};
+        FieldView<Shape, const D> density{densityp, s};
+        View outX{outXp, s}, outY{outYp, s};
+        float h = 1/(float) std::min(s.nx, s.ny);
+        float scale = 0.5f/h, confinement = dt*vorticity*h, lift = dt*buoyancy;
+
+        forRows(rowBegin(), rowEnd(), [&](uint32_t jBegin, uint32_t jEnd, uint32_t) {
+            std::vector<float> window(3*(size_t) s.stride);
+            auto curlRow = [&](uint32_t j) { return window.data() + (size_t) s.stride*(j % 3); };
+            auto computeCurl = [&](uint32_t j) {
+                float* w = curlRow(j);
+                uint32_t i, iEnd;
+                forceColumns(j, i, iEnd);
+                if (j < 1 || j > s.ny || i > iEnd) {
+                    std::fill(w, w + s.stride, 0.0f);
+                    return;
+                }
+                // Curl is zero on the boundary ring, which only mirrors the interior
+                w[0] = w[s.nx + 1] = 0.0f;
+#if FLUID_HAS_SIMD
+                if (m_simd) {
+                    using namespace simd;
+                    const F vs = set1(scale);
+                    for (; i + WIDTH - 1 <= iEnd; i += WIDTH) {
+                        F dy = sub(load(&velY(i + 1, j)), load(&velY(i - 1, j)));
+                        F dx = sub(load(&velX(i, j + 1)), load(&velX(i, j - 1)));
+                        store(w + i, mul(vs, sub(dy, dx)));
+                    }
+                }
+#endif
+                for (; i <= iEnd; ++i) {
+                    w[i] = scale*((velY(i + 1, j) - velY(i - 1, j)) - (velX(i, j + 1) - velX(i, j - 1)));
+                }
+            };
+
+            computeCurl(jBegin - 1);
+            computeCurl(jBegin);
+            for (uint32_t j = jBegin; j < jEnd; ++j) {
+                computeCurl(j + 1);
+                const float *below = curlRow(j - 1), *at = curlRow(j), *above = curlRow(j + 1);
+                uint32_t i, iEnd;
+                columns(j, i, iEnd);
+#if FLUID_HAS_SIMD
+                if constexpr (std::is_same<D, float>::value) {
+                    if (m_simd) {
+                        using namespace simd;
+                        const F vs = set1(scale), vc = set1(confinement), vl = set1(lift), tiny = set1(1e-5f);
+                        for (; i + WIDTH - 1 <= iEnd; i += WIDTH) {
+                            F gx = mul(vs, sub(abs(load(at + i + 1)), abs(load(at + i - 1))));
+                            F gy = mul(vs, sub(abs(load(above + i)), abs(load(below + i))));
+                            F length = add(simd::sqrt(add(mul(gx, gx), mul(gy, gy))), tiny);
+                            F w = load(at + i);
+                            store(&outX(i, j), add(load(&velX(i, j)), mul(vc, mul(div(gy, length), w))));
+                            store(&outY(i, j), add(sub(load(&velY(i, j)), mul(vc, mul(div(gx, length), w))),
+                                                   mul(vl, load(&density(i, j)))));
+                        }
+                    }
+                }
+#endif
+                for (; i <= iEnd; ++i) {
+                    float gx = scale*(std::abs(at[i + 1]) - std::abs(at[i - 1]));
+                    float gy = scale*(std::abs(above[i]) - std::abs(below[i]));
+                    float length = std::sqrt(gx*gx + gy*gy) + 1e-5f;
+                    outX(i, j) = velX(i, j) + confinement*((gy/length)*at[i]);
+                    outY(i, j) = (velY(i, j) - confinement*((gx/length)*at[i])) + lift*valueOf(density(i, j));
+                }
+            }
+        });
+    }
+
+    // Central-difference divergence, scaled so the pressure solve is 4p - sum(neighbours) = div.
+    // Also clears p as the initial guess.
+    void divergence(const float* velXp, const float* velYp, float* divp, float* pp) const {
+        ConstView velX{velXp, s}, velY{velYp, s};
+        View div{divp, s}, p{pp, s};
+        float h = 1/(float) std::min(s.nx, s.ny);
+
+        forRows(rowBegin(), rowEnd(), [&](uint32_t jBegin, uint32_t jEnd, uint32_t) {
+            for (uint32_t j = jBegin; j < jEnd; ++j) {
+                uint32_t i, iEnd;
+                columns(j, i, iEnd);
+#if FLUID_HAS_SIMD
+                if (m_simd) {
+                    using namespace simd;
+                    const F c = set1(-0.5f*h), zero = set1(0.0f);
+                    for (; i + WIDTH - 1 <= iEnd; i += WIDTH) {
+                        F d = add(sub(load(&velX(i + 1, j)), load(&velX(i - 1, j))), load(&velY(i, j + 1)));
+                        store(&div(i, j), mul(c, sub(d, load(&velY(i, j - 1)))));
+                        store(&p(i, j), zero);
+                    }
+                }
+#endif
+                for (; i <= iEnd; ++i) {
+                    div(i, j) = -0.5f*h*(velX(i + 1, j) - velX(i - 1, j) + velY(i, j + 1) - velY(i, j - 1));
+                    p(i, j) = 0;
+                }
+            }
+        });
+        if (m_obstacles) {
+            // No flow through the walls: the normal component is mirrored into them
+            for (const Obstacles::Cell& cell : m_obstacles->edges()) {
+                if (!cell.code) continue;
+                uint32_t i = cell.index % s.stride, j = cell.index/s.stride;
+                float right = cell.code & Obstacles::RIGHT ? -velX(i, j) : velX(i + 1, j);
+                float left = cell.code & Obstacles::LEFT ? -velX(i, j) : velX(i - 1, j);
+                float up = cell.code & Obstacles::UP ? -velY(i, j) : velY(i, j + 1);
+                float down = cell.code & Obstacles::DOWN ? -velY(i, j) : velY(i, j - 1);
+                div(i, j) = -0.5f*h*(right - left + up - down);
+            }
+        }
+        setBounds(divp);
+        setBounds(pp);
+    }
+
+    void relaxPressure(float* pp, const float* divp, uint32_t iterations) const {
+        View p{pp, s};
+        ConstView div{divp, s};
+#if FLUID_HAS_SIMD
+        // Dividing by 4 is exact as a multiply by 0.25, which is what the scalar code compiles to
+        const simd::F quarter = simd::set1(0.25f);
+#endif
+        relax(std::array<float*, 1>{pp}, iterations, [&](uint32_t i, uint32_t j, uint8_t solid) {
+            p(i,j) = (div(i,j) + neighbour<Obstacles::RIGHT>(p, i, j, solid) + neighbour<Obstacles::LEFT>(p, i, j, solid)
+                      + neighbour<Obstacles::UP>(p, i, j, solid) + neighbour<Obstacles::DOWN>(p, i, j, solid))/4;
+        }
+#if FLUID_HAS_SIMD
+        , [&](uint32_t i, uint32_t j, simd::Mask color) {
+            using namespace simd;
+            F sum = add(add(add(add(load(&div(i,j)), load(&p(i + 1,j))), load(&p(i - 1,j))), load(&p(i,j + 1))), load(&p(i,j - 1)));
+            return Lanes<1>{{select(color, mul(sum, quarter), load(&p(i,j)))}};
+        }
+#endif
+        );
+    }
+
+    // r = div - A p for the pressure operator, returns max |r|
+    float pressureResidual(const float* pp, const float* divp, float* rp) const {
+        ConstView p{pp, s}, div{divp, s};
+        View r{rp, s};
+        std::vector<float> bandMax(bands(), 0.0f);
+        forRows(1, s.ny + 1, [&](uint32_t jBegin, uint32_t jEnd, uint32_t band) {
+            float maxAbs = 0.0f;
+            for (uint32_t j = jBegin; j < jEnd; ++j) {
+                rowCells(j, 1, s.nx, [&](uint32_t begin, uint32_t end) {
+                    for (uint32_t i = begin; i <= end; ++i) {
+                        r(i,j) = div(i,j) - (4*p(i,j) - p(i + 1,j) - p(i - 1,j) - p(i,j + 1) - p(i,j - 1));
+                        maxAbs = std::max(maxAbs, std::abs(r(i,j)));
+                    }
+                }, [&](uint32_t i, uint8_t code) {
+                    if (code & Obstacles::SOLID) {
+                        r(i,j) = 0.0f;
+                        return;
+                    }
+                    r(i,j) = div(i,j) - (4*p(i,j) - neighbour<Obstacles::RIGHT>(p, i, j, code) - neighbour<Obstacles::LEFT>(p, i, j, code)
+                                         - neighbour<Obstacles::UP>(p, i, j, code) - neighbour<Obstacles::DOWN>(p, i, j, code));
+                    maxAbs = std::max(maxAbs, std::abs(r(i,j)));
+                });
+            }
+            bandMax[band] = maxAbs;
+        });
+        return *std::max_element(bandMax.begin(), bandMax.end());
+    }
+
+    // Largest velocity component over the interior, in domain units per second
+    float maxVelocity(const float* velXp, const float* velYp) const {
+        ConstView velX{velXp, s}, velY{velYp, s};
+        std::vector<float> bandMax(bands(), 0.0f);
+        forRows(1, s.ny + 1, [&](uint32_t jBegin, uint32_t jEnd, uint32_t band) {
+            float maxAbs = 0.0f;
+            for (uint32_t j = jBegin; j < jEnd; ++j) {
+                for (uint32_t i = 1; i <= s.nx; ++i) {
+                    maxAbs = std::max(maxAbs, std::max(std::abs(velX(i,j)), std::abs(velY(i,j))));
+                }
+            }
+            bandMax[band] = maxAbs;
+        });
+        return *std::max_element(bandMax.begin(), bandMax.end());
+    }
+
+    void subtractGradient(float* velXp, float* velYp, const float* pp) const {
+        View velX{velXp, s}, velY{velYp, s};
+        ConstView p{pp, s};
+        float h = 1/(float) std::min(s.nx, s.ny);
+        // Cells next to a wall see no pressure difference across it; their
+        // results are worked out first, while the velocities are unchanged
+        std::vector<float> edges;
+        if (m_obstacles) {
+            for (const Obstacles::Cell& cell : m_obstacles->edges()) {
+                uint32_t i = cell.index % s.stride, j = cell.index/s.stride;
+                uint8_t code = cell.code;
+                edges.push_back(velX(i,j) - 0.5f*(neighbour<Obstacles::RIGHT>(p, i, j, code)
+                                                  - neighbour<Obstacles::LEFT>(p, i, j, code))/h);
+                edges.push_back(velY(i,j) - 0.5f*(neighbour<Obstacles::UP>(p, i, j, code)
+                                                  - neighbour<Obstacles::DOWN>(p, i, j, code))/h);
+            }
+        }
+
+        forRows(rowBegin(), rowEnd(), [&](uint32_t jBegin, uint32_t jEnd, uint32_t) {
+            for (uint32_t j = jBegin; j < jEnd; ++j) {
+                uint32_t i, iEnd;
+                columns(j, i, iEnd);
+#if FLUID_HAS_SIMD
+                if (m_simd) {
+                    using namespace simd;
+                    const F half = set1(0.5f), vh = set1(h);
+                    for (; i + WIDTH - 1 <= iEnd; i += WIDTH) {
+                        F gx = div(mul(half, sub(load(&p(i + 1,j)), load(&p(i - 1,j)))), vh);
+                        F gy = div(mul(half, sub(load(&p(i,j + 1)), load(&p(i,j - 1)))), vh);
+                        store(&velX(i,j), sub(load(&velX(i,j)), gx));
+                        store(&velY(i,j), sub(load(&velY(i,j)), gy));
+                    }
+                }
+#endif
+                for (; i <= iEnd; ++i) {
+                    velX(i,j) -= 0.5f*(p(i + 1,j) - p(i - 1,j))/h;
+                    velY(i,j) -= 0.5f*(p(i,j + 1) - p(i,j - 1))/h;
+                }
+            }
+        });
+        for (size_t k = 0; k < edges.size()/2; ++k) {
+            uint32_t index = m_obstacles->edges()[k].index;
+            velXp[index] = edges[2*k];
+            velYp[index] = edges[2*k + 1];
+        }
+        setBounds(velXp, FluidSolver::MIRROR_X);
+        setBounds(velYp, FluidSolver::MIRROR_Y);
+    }
+
+    // T is float or a 16-bit fixed point density, which has no sign to mirror
+    template<class T>
+    void setBounds(T* xp, BoundConfig b = FluidSolver::REGULAR) const {
+        FieldView<Shape, T> x{xp, s};
+        if (m_obstacles) setObstacleBounds(xp, b);
+        for (uint32_t i = 1; i <= s.nx; ++i) {
+            setValue(x(i, 0), (b == FluidSolver::MIRROR_Y) ? -valueOf(x(i, 1)) : valueOf(x(i, 1)));
+            setValue(x(i, s.ny+1), (b == FluidSolver::MIRROR_Y) ? -valueOf(x(i, s.ny)) : valueOf(x(i, s.ny)));
+        }
+        for (uint32_t i = 1; i <= s.ny; ++i) {
+            setValue(x(0, i), (b == FluidSolver::MIRROR_X) ? -valueOf(x(1, i)) : valueOf(x(1, i)));
+            setValue(x(s.nx+1, i), (b == FluidSolver::MIRROR_X) ? -valueOf(x(s.nx, i)) : valueOf(x(s.nx, i)));
+        }
+
+        setValue(x(0, 0), 0.5f*(valueOf(x(1, 0))+valueOf(x(0, 1))));
+        setValue(x(0, s.ny+1), 0.5f*(valueOf(x(1, s.ny+1))+valueOf(x(0, s.ny))));
+        setValue(x(s.nx+1, 0), 0.5f*(valueOf(x(s.nx, 0))+valueOf(x(s.nx+1, 1))));
+        setValue(x(s.nx+1, s.ny+1), 0.5f*(valueOf(x(s.nx, s.ny+1))+valueOf(x(s.nx+1, s.ny))));
+    }
+
+    // Dissolves the whole field, boundary included, and writes the colours when asked
+    template<class T>
+    void dissolve(T* dp, float amount, const FluidSolver::ColorTarget* color = nullptr) const {
+        FieldView<Shape, T> d{dp, s};
+        forRows(0, s.ny + 2, [&](uint32_t jBegin, uint32_t jEnd, uint32_t) {
+            for (uint32_t j = jBegin; j < jEnd; ++j) {
+                uint32_t i = 0;
+#if FLUID_HAS_SIMD
+                if constexpr (std::is_same<T, float>::value) {
+                    if (m_simd) {
+                        using namespace simd;
+                        const F vAmount = set1(amount), lo = set1(0.0f), hi = set1(2.0f);
+                        for (; i + WIDTH <= s.nx + 2; i += WIDTH) {
+                            store(&d(i, j), min(hi, max(lo, sub(load(&d(i, j)), vAmount))));
+                        }
+                    }
+                }
+#endif
+                for (; i < s.nx + 2; ++i) {
+                    setValue(d(i, j), std::clamp(valueOf(d(i, j)) - amount, 0.0f, 2.0f));
+                }
+                if (color) writeColors(*color, dp, j, 0, s.nx + 1);
+            }
+        });
+    }
+
+    // Calls fn(begin, end, band) on row bands, in parallel when worthwhile
+    template<class F>
+    void forRows(uint32_t begin, uint32_t end, F&& fn) const {
+        if (bands() == 1 || (end - begin)*s.nx < MIN_PARALLEL_CELLS) {
+            fn(begin, end, 0);
+        } else {
+            m_pool->parallelFor(begin, end, fn);
+        }
+    }
+
+    uint32_t bands() const { return m_pool ? m_pool->size() : 1; }
+
+    // Interior rows [rowBegin, rowEnd) and columns [begin, end] of row j the stencil loops visit
+    uint32_t rowBegin() const { return m_region ? m_region->rowBegin() : 1; }
+    uint32_t rowEnd() const { return m_region ? m_region->rowEnd() : s.ny + 1; }
+    void columns(uint32_t j, uint32_t& begin, uint32_t& end) const {
+        if (m_region) {
+            m_region->columns(j, begin, end);
+        } else {
+            begin = 1;
+            end = s.nx;
+        }
+    }
+
+private:
+    // Cell values as the arithmetic sees them, for float and 16-bit fixed point fields
+    static float valueOf(float v) { return v; }
+    static float valueOf(uint16_t v) { return fixed16::toFloat(v); }
+    static void setValue(float& out, float v) { out = v; }
+    static void setValue(uint16_t& out, float v) { out = fixed16::fromFloat(v); }
+
+    // Solid cells next to fluid average their fluid neighbours, mirroring
+    // the component normal to the wall; cells inside the solid are zero
+    template<class T>
+    void setObstacleBounds(T* xp, BoundConfig b) const {
+        float signX = b == FluidSolver::MIRROR_X ? -1.0f : 1.0f;
+        float signY = b == FluidSolver::MIRROR_Y ? -1.0f : 1.0f;
+        for (const Obstacles::Cell& cell : m_obstacles->boundary()) {
+            T* x = xp + cell.index;
+            float sum = 0.0f;
+            uint32_t count = 0;
+            if (cell.code & Obstacles::LEFT) {
+                sum += signX*valueOf(x[-1]);
+                count++;
+            }
+            if (cell.code & Obstacles::RIGHT) {
+                sum += signX*valueOf(x[1]);
+                count++;
+            }
+            if (cell.code & Obstacles::DOWN) {
+                sum += signY*valueOf(x[-(ptrdiff_t) s.stride]);
+                count++;
+            }
+            if (cell.code & Obstacles::UP) {
+                sum += signY*valueOf(x[s.stride]);
+                count++;
+            }
+            setValue(*x, sum/(float) count);
+        }
+        for (uint32_t index : m_obstacles->inner()) xp[index] = T{};
+    }
+
+    // Columns whose curl the force rows j - 1 to j + 1 read: their spans one
+    // cell wider, within the interior
+    void forceColumns(uint32_t j, uint32_t& begin, uint32_t& end) const {
+        begin = s.nx + 1;
+        end = 0;
+        for (uint32_t r = j - 1; r <= j + 1; ++r) {
+            if (r < rowBegin() || r >= rowEnd()) continue;
+            uint32_t b, e;
+            columns(r, b, e);
+            if (b > e) continue;
+            begin = std::min(begin, std::max(b, 2u) - 1);
+            end = std::max(end, std::min(e + 1, (uint32_t) s.nx));
+        }
+    }
+
+    template<size_t N>
+    void diffuseFields(const std::array<float*, N>& xs, const std::array<const float*, N>& x0s, float diff, float dt) const {
+        float a = dt*diff*(float)(s.ny*s.nx);
+#if FLUID_HAS_SIMD
+        const simd::F va = simd::set1(a), vc = simd::set1(1+4*a);
+#endif
+        relax(xs, 20, [&](uint32_t i, uint32_t j, uint8_t solid) {
+            for (size_t c = 0; c < N; ++c) {
+                View x{xs[c], s};
+                ConstView x0{x0s[c], s};
+                float sum = neighbour<Obstacles::LEFT>(x, i, j, solid) + neighbour<Obstacles::RIGHT>(x, i, j, solid)
+                            + neighbour<Obstacles::DOWN>(x, i, j, solid) + neighbour<Obstacles::UP>(x, i, j, solid);
+                x(i,j) = (x0(i,j) + a*sum)/(1+4*a);
+            }
+        }
+#if FLUID_HAS_SIMD
+        , [&](uint32_t i, uint32_t j, simd::Mask color) {
+            using namespace simd;
+            Lanes<N> result;
+            for (size_t c = 0; c < N; ++c) {
+                View x{xs[c], s};
+                ConstView x0{x0s[c], s};
+                F sum = add(add(add(load(&x(i-1,j)), load(&x(i+1,j))), load(&x(i,j-1))), load(&x(i,j+1)));
+                F v = div(add(load(&x0(i,j)), mul(va, sum)), vc);
+                result[c] = select(color, v, load(&x(i,j)));
+            }
+            return result;
+        }
+#endif
+        );
+    }
+
+    // Advection of N fields along (velX, velY) with the configured scheme.
+    // When given, dissolve is subtracted and clamped in the same pass, and
+    // the result is written out as display colour while the row is still in
+    // cache.
+    template<size_t N>
+    void advectFields(const std::array<float*, N>& ds, const std::array<const float*, N>& d0s, const std::array<BoundConfig, N>& bounds,
+                      const float* velXp, const float* velYp, float dt, const float* dissolve, const FluidSolver::ColorTarget* color) const {
+        if (m_advection.scheme == FluidSolver::SEMI_LAGRANGIAN || !m_advection.scratch[2*N - 1]) {
+            backtraceFields<N>(ds, d0s, bounds, velXp, velYp, dt, dissolve, color);
+        } else {
+            correctedFields<N>(ds, d0s, bounds, velXp, velYp, dt, dissolve, color);
+        }
+        if (m_obstacles) advectEdges<N>(ds, d0s, bounds, velXp, velYp, dt, dissolve, color);
+    }
+
+    // Cells next to walls are traced again, semi-Lagrangian, at most one cell
+    // back and with solid source cells read as the cell's own source value,
+    // so nothing is picked up from the far side of a wall
+    template<size_t N, class T>
+    void advectEdges(const std::array<T*, N>& ds, const std::array<const T*, N>& d0s, const std::array<BoundConfig, N>& bounds,
+                     const float* velXp, const float* velYp, float dt, const float* dissolve, const FluidSolver::ColorTarget* color) const {
+        ConstView velX{velXp, s}, velY{velYp, s};
+        float dt0 = dt*(float) std::min(s.nx, s.ny);
+        for (const Obstacles::Cell& cell : m_obstacles->edges()) {
+            uint32_t i = cell.index % s.stride, j = cell.index/s.stride;
+            float x = std::min(std::max(0.5f, (float) i - std::clamp(dt0*velX(i, j), -1.0f, 1.0f)), (float) s.nx + 0.5f);
+            float y = std::min(std::max(0.5f, (float) j - std::clamp(dt0*velY(i, j), -1.0f, 1.0f)), (float) s.ny + 0.5f);
+            auto i0 = (uint32_t) x, j0 = (uint32_t) y;
+            float s1 = x - (float) i0, t1 = y - (float) j0, s0 = 1 - s1, t0 = 1 - t1;
+            for (size_t c = 0; c < N; ++c) {
+                FieldView<Shape, const T> d0{d0s[c], s};
+                auto at = [&](uint32_t si, uint32_t sj) { return valueOf(m_obstacles->solid(si, sj) ? d0(i, j) : d0(si, sj)); };
+                float v = s0*(t0*at(i0, j0) + t1*at(i0, j0 + 1)) + s1*(t0*at(i0 + 1, j0) + t1*at(i0 + 1, j0 + 1));
+                if (dissolve) v = std::clamp(v - *dissolve, 0.0f, 2.0f);
+                setValue(ds[c][cell.index], v);
+            }
+            if (color) writeColors(*color, ds[0], j, i, i);
+        }
+        for (size_t c = 0; c < N; ++c) setBounds(ds[c], bounds[c]);
+    }
+
+    // MacCormack or BFECC pass of advectFields
+    template<size_t N>
+    void correctedFields(const std::array<float*, N>& ds, const std::array<const float*, N>& d0s, const std::array<BoundConfig, N>& bounds,
+                         const float* velXp, const float* velYp, float dt, const float* dissolve, const FluidSolver::ColorTarget* color) const {
+        std::array<float*, N> forward, backward;
+        std::array<const float*, N> forwardIn, backwardIn;
+        for (size_t c = 0; c < N; ++c) {
+            forward[c] = m_advection.scratch[c];
+            backward[c] = m_advection.scratch[N + c];
+            forwardIn[c] = forward[c];
+            backwardIn[c] = backward[c];
+        }
+        // The backward trace undoes the forward one; half their difference
+        // from the source is the error of a round trip
+        backtraceFields<N>(forward, d0s, bounds, velXp, velYp, dt, nullptr, nullptr);
+        backtraceFields<N>(backward, forwardIn, bounds, velXp, velYp, -dt, nullptr, nullptr);
+        if (m_advection.scheme == FluidSolver::BFECC) {
+            // The source corrected by that error is advected again
+            forRows(rowBegin(), rowEnd(), [&](uint32_t jBegin, uint32_t jEnd, uint32_t) {
+                for (uint32_t j = jBegin; j < jEnd; ++j) {
+                    uint32_t i, iEnd;
+                    columns(j, i, iEnd);
+                    for (size_t c = 0; c < N; ++c) {
+                        const float* d0 = d0s[c] + s.stride*j;
+                        float* bar = backward[c] + s.stride*j;
+                        for (uint32_t k = i; k <= iEnd; ++k) bar[k] = d0[k] + 0.5f*(d0[k] - bar[k]);
+                    }
+                }
+            });
+            for (size_t c = 0; c < N; ++c) setBounds(backward[c], bounds[c]);
+            limitedFields<N>(ds, d0s, nullptr, backwardIn, bounds, velXp, velYp, dt, dissolve, color);
+        } else {
+            limitedFields<N>(ds, d0s, &forwardIn, backwardIn, bounds, velXp, velYp, dt, dissolve, color);
+        }
+    }
+
+    // Monotonic cubic between p1 and p2: the end slopes are limited to
+    // [0, 3 delta] (Fritsch-Carlson), so the curve never leaves [p1, p2]
+    static float monotonicCubic(float p0, float p1, float p2, float p3, float t) {
+        float delta = p2 - p1;
+        float d1 = 0.5f*(p2 - p0), d2 = 0.5f*(p3 - p1);
+        if (delta == 0.0f) {
+            d1 = d2 = 0.0f;
+        } else {
+            if (d1*delta <= 0.0f) d1 = 0.0f;
+            if (d2*delta <= 0.0f) d2 = 0.0f;
+            if (std::abs(d1) > 3.0f*std::abs(delta)) d1 = 3.0f*delta;
+            if (std::abs(d2) > 3.0f*std::abs(delta)) d2 = 3.0f*delta;
+        }
+        float a3 = d1 + d2 - 2.0f*delta, a2 = 3.0f*delta - 2.0f*d1 - d2;
+        return ((a3*t + a2)*t + d1)*t + p1;
+    }
+
+    // Value of d at (x, y), between cells (i0, j0) and (i0 + 1, j0 + 1)
+    float interpolate(ConstView d, float x, float y, int i0, int j0) const {
+        float s1 = x - (float) i0, t1 = y - (float) j0;
+        if (m_advection.interpolation == FluidSolver::MONOTONIC_CUBIC) {
+            // The 4x4 stencil is clamped to the boundary ring
+            auto lastX = (int) s.nx + 1, lastY = (int) s.ny + 1;
+            auto ia = (uint32_t) std::max(i0 - 1, 0), ib = (uint32_t) i0;
+            auto ic = (uint32_t) std::min(i0 + 1, lastX), id = (uint32_t) std::min(i0 + 2, lastX);
+            float rows[4];
+            for (int r = 0; r < 4; ++r) {
+                const float* row = &d(0, (uint32_t) std::clamp(j0 - 1 + r, 0, lastY));
+                rows[r] = monotonicCubic(row[ia], row[ib], row[ic], row[id], s1);
+            }
+            return monotonicCubic(rows[0], rows[1], rows[2], rows[3], t1);
+        }
+        float s0 = 1 - s1, t0 = 1 - t1;
+        auto i = (uint32_t) i0, j = (uint32_t) j0;
+        return s0*(t0*d(i, j) + t1*d(i, j + 1)) + s1*(t0*d(i + 1, j) + t1*d(i + 1, j + 1));
+    }
+
+    // Final pass of the corrected schemes. With forward fields it is
+    // MacCormack: forward + (source - backward)/2 at the cell; without, it
+    // is BFECC and backward holds the corrected source to interpolate.
+    // Either way the value is clamped to the source cells around the backtrace.
+    template<size_t N>
+    void limitedFields(const std::array<float*, N>& ds, const std::array<const float*, N>& d0s,
+                       const std::array<const float*, N>* forward, const std::array<const float*, N>& backward,
+                       const std::array<BoundConfig, N>& bounds, const float* velXp, const float* velYp, float dt,
+                       const float* dissolve, const FluidSolver::ColorTarget* color) const {
+        ConstView velX{velXp, s}, velY{velYp, s};
+        auto fNX = (float) s.nx;
+        auto fNY = (float) s.ny;
+        float dt0 = dt*std::min(fNX, fNY);
+        bool vectorised = m_simd && m_advection.interpolation == FluidSolver::BILINEAR;
+
+        forRows(rowBegin(), rowEnd(), [&](uint32_t jBegin, uint32_t jEnd, uint32_t) {
+            for (uint32_t j = jBegin; j < jEnd; ++j) {
+                uint32_t iBegin, iEnd;
+                columns(j, iBegin, iEnd);
+                uint32_t i = iBegin;
+#if FLUID_HAS_SIMD
+                if (vectorised) i = limitedRowSimd<N>(ds, d0s, forward, backward, velXp, velYp, dt0, dissolve, j, i, iEnd);
+#endif
+                for (; i <= iEnd; ++i) {
+                    float x = std::min(std::max(0.5f, (float) i - dt0*velX(i, j)), fNX + 0.5f);
+                    float y = std::min(std::max(0.5f, (float) j - dt0*velY(i, j)), fNY + 0.5f);
+                    int i0 = (int) x, j0 = (int) y;
+                    auto i1 = (uint32_t) i0 + 1, j1 = (uint32_t) j0 + 1;
+
+                    for (size_t c = 0; c < N; ++c) {
+                        View d{ds[c], s};
+                        ConstView d0{d0s[c], s}, back{backward[c], s};
+                        float d00 = d0((uint32_t) i0, (uint32_t) j0), d01 = d0((uint32_t) i0, j1);
+                        float d10 = d0(i1, (uint32_t) j0), d11 = d0(i1, j1);
+                        float lo = std::min(std::min(d00, d01), std::min(d10, d11));
+                        float hi = std::max(std::max(d00, d01), std::max(d10, d11));
+                        float v = forward ? ConstView{(*forward)[c], s}(i, j) + 0.5f*(d0(i, j) - back(i, j))
+                                          : interpolate(back, x, y, i0, j0);
+                        d(i, j) = std::min(std::max(lo, v), hi);
+                        if (dissolve) d(i, j) = std::clamp(d(i, j) - *dissolve, 0.0f, 2.0f);
+                    }
+                }
+                if (color) writeColors(*color, ds[0], j, iBegin, iEnd);
+            }
+        });
+        for (size_t c = 0; c < N; ++c) setBounds(ds[c], bounds[c]);
+        if (color) writeBorderColors(*color, ds[0]);
+    }
+
+    // Semi-Lagrangian pass: each cell takes the value its backtrace lands on.
+    // Fixed point fields only take the scalar bilinear loop.
+    template<size_t N, class T>
+    void backtraceFields(const std::array<T*, N>& ds, const std::array<const T*, N>& d0s, const std::array<BoundConfig, N>& bounds,
+                         const float* velXp, const float* velYp, float dt, const float* dissolve, const FluidSolver::ColorTarget* color) const {
+        ConstView velX{velXp, s}, velY{velYp, s};
+        auto fNX = (float) s.nx;
+        auto fNY = (float) s.ny;
+        float dt0 = dt*std::min(fNX, fNY);
+        bool cubic = m_advection.interpolation == FluidSolver::MONOTONIC_CUBIC;
+
+        forRows(rowBegin(), rowEnd(), [&](uint32_t jBegin, uint32_t jEnd, uint32_t) {
+            int i0, j0, i1, j1;
+            float x, y, s0, t0, s1, t1;
+            for (uint32_t j = jBegin; j < jEnd; ++j) {
+                uint32_t iBegin, iEnd;
+                columns(j, iBegin, iEnd);
+                uint32_t i = iBegin;
+                if constexpr (std::is_same<T, float>::value) {
+#if FLUID_HAS_SIMD
+                    if (m_simd && !cubic) i = advectRowSimd<N>(ds, d0s, velXp, velYp, dt0, dissolve, j, i, iEnd);
+#endif
+                    for (; cubic && i <= iEnd; ++i) {
+                        x = std::min(std::max(0.5f, (float) i - dt0*velX(i, j)), fNX + 0.5f);
+                        y = std::min(std::max(0.5f, (float) j - dt0*velY(i, j)), fNY + 0.5f);
+                        for (size_t c = 0; c < N; ++c) {
+                            View d{ds[c], s};
+                            d(i, j) = interpolate(ConstView{d0s[c], s}, x, y, (int) x, (int) y);
+                            if (dissolve) d(i, j) = std::clamp(d(i, j) - *dissolve, 0.0f, 2.0f);
+                        }
+                    }
+                }
+                for (; i <= iEnd; ++i) {
+                    x = std::min(std::max(0.5f, (float) i - dt0*velX(i, j)), fNX + 0.5f);
+                    y = std::min(std::max(0.5f, (float) j - dt0*velY(i, j)), fNY + 0.5f);
+                    i0 = (int) x;
+                    i1 = i0 + 1;
+                    j0 = (int) y;
+                    j1 = j0 + 1;
+                    s1 = x - (float) i0;
+                    t1 = y - (float) j0;
+                    s0 = 1 - s1;
+                    t0 = 1 - t1;
+
+                    for (size_t c = 0; c < N; ++c) {
+                        FieldView<Shape, const T> d0{d0s[c], s};
+                        float v = s0*(t0*valueOf(d0(i0, j0)) + t1*valueOf(d0(i0, j1)))
+                                  + s1*(t0*valueOf(d0(i1, j0)) + t1*valueOf(d0(i1, j1)));
+                        if (dissolve) v = std::clamp(v - *dissolve, 0.0f, 2.0f);
+                        setValue(ds[c][i + s.stride*j], v);
+                    }
+                }
+                if (color) writeColors(*color, ds[0], j, iBegin, iEnd);
+            }
+        });
+        for (size_t c = 0; c < N; ++c) setBounds(ds[c], bounds[c]);
+        if (color) writeBorderColors(*color, ds[0]);
+    }
+
+    // iterations Gauss-Seidel sweeps of the fields xs over the interior in
+    // the configured order, each followed by setBounds. update(i, j, solid)
+    // relaxes one cell of every field, reading the sides set in solid (see
+    // neighbour) as the cell itself; vectorUpdate(i, j, mask) returns
+    // simd::WIDTH relaxed cells from i for every field, keeping the old value
+    // where the mask is clear, and only red-black uses it. Solid cells are
+    // skipped and cells next to them always take the scalar update.
+    template<class T, size_t N, class Update, class VectorUpdate = std::nullptr_t>
+    void relax(const std::array<T*, N>& xs, uint32_t iterations, Update&& update,
+               VectorUpdate&& vectorUpdate = nullptr) const {
+        if (m_blockSweeps && bands() == 1 && !m_region && !m_obstacles && iterations > 1) {
+            relaxBlocked(xs, iterations, update, vectorUpdate);
+            return;
+        }
+        for (uint32_t k = 0; k < iterations; ++k) {
+            sweep(xs, update, vectorUpdate);
+            for (T* x : xs) setBounds(x);
+        }
+    }
+
+    // One sweep in the configured order, without the bounds
+    template<class T, size_t N, class Update, class VectorUpdate = std::nullptr_t>
+    void sweep(const std::array<T*, N>& xs, Update&& update, VectorUpdate&& vectorUpdate = nullptr) const {
+        if (m_order == FluidSolver::RED_BLACK) {
+            for (uint32_t color = 0; color < 2; ++color) {
+                forRows(rowBegin(), rowEnd(), [&](uint32_t jBegin, uint32_t jEnd, uint32_t) {
+                    for (uint32_t j = jBegin; j < jEnd; ++j) {
+                        uint32_t i, iEnd;
+                        columns(j, i, iEnd);
+                        rowCells(j, i, iEnd, [&](uint32_t begin, uint32_t end) {
+                            relaxRow(xs, j, begin, end, color, update, vectorUpdate);
+                        }, [&](uint32_t ci, uint8_t code) {
+                            if (!(code & Obstacles::SOLID) && ((ci + j + color) & 1) == 0) update(ci, j, code);
+                        });
+                    }
+                });
+            }
+        } else {
+            for (uint32_t j = rowBegin(); j < rowEnd(); ++j) {
+                uint32_t i, iEnd;
+                columns(j, i, iEnd);
+                rowCells(j, i, iEnd, [&](uint32_t begin, uint32_t end) {
+                    for (uint32_t ci = begin; ci <= end; ++ci) update(ci, j, 0);
+                }, [&](uint32_t ci, uint8_t code) {
+                    if (!(code & Obstacles::SOLID)) update(ci, j, code);
+                });
+            }
+        }
+    }
+
+    // Splits columns [i, iEnd] of row j at the cells Obstacles lists for it:
+    // span(begin, end) gets the plain fluid runs, cell(i, code) the others
+    template<class Span, class Cell>
+    void rowCells(uint32_t j, uint32_t i, uint32_t iEnd, Span&& span, Cell&& cell) const {
+        if (m_obstacles) {
+            for (const Obstacles::Cell* c = m_obstacles->rowBegin(j); c != m_obstacles->rowEnd(j); ++c) {
+                uint32_t ci = c->index - s.stride*j;
+                if (ci < i) continue;
+                if (ci > iEnd) break;
+                if (ci > i) span(i, ci - 1);
+                cell(ci, c->code);
+                i = ci + 1;
+            }
+        }
+        if (i <= iEnd) span(i, iEnd);
+    }
+
+    // x(i, j)'s neighbour on the given side, or x(i, j) itself when that side is solid
+    template<Obstacles::Direction side, class V>
+    static auto neighbour(const V& x, uint32_t i, uint32_t j, uint8_t solid) {
+        if (solid & side) return x(i, j);
+        switch (side) {
+            case Obstacles::LEFT: return x(i - 1, j);
+            case Obstacles::RIGHT: return x(i + 1, j);
+            case Obstacles::DOWN: return x(i, j - 1);
+            default: return x(i, j + 1);
+        }
+    }
+
+    // The cells of one colour in columns [i, iEnd] of row j
+    template<class T, size_t N, class Update, class VectorUpdate>
+    void relaxRow(const std::array<T*, N>& xs, uint32_t j, uint32_t i, uint32_t iEnd, uint32_t color, Update&& update,
+                  VectorUpdate&& vectorUpdate) const {
+#if FLUID_HAS_SIMD
+        if constexpr (!std::is_same<std::decay_t<VectorUpdate>, std::nullptr_t>::value) {
+            if (m_simd && i + simd::WIDTH - 1 <= iEnd) {
+                // The colour sits on a fixed lane parity along the row
+                const simd::Mask mask = simd::parityMask((i + j + color) & 1);
+                // Each block is stored only after the next one has been loaded: its
+                // loads overlap the previous block and would stall on store forwarding.
+                // Lanes of the colour being relaxed never read that overlap.
+                Lanes<N> pending = vectorUpdate(i, j, mask);
+                uint32_t pendingAt = i;
+                for (i += simd::WIDTH; i + simd::WIDTH - 1 <= iEnd; i += simd::WIDTH) {
+                    Lanes<N> next = vectorUpdate(i, j, mask);
+                    for (size_t c = 0; c < N; ++c) simd::store(xs[c] + pendingAt + s.stride*j, pending[c]);
+                    pending = next;
+                    pendingAt = i;
+                }
+                for (size_t c = 0; c < N; ++c) simd::store(xs[c] + pendingAt + s.stride*j, pending[c]);
+            }
+        }
+#endif
+        for (i += (i + j + color) & 1; i <= iEnd; i += 2) {
+            update(i, j, 0);
+        }
+    }
+
+    // The sweeps of relax as a wavefront: sweep k relaxes row t - 2k at step
+    // t, so each row is revisited while the few rows around it are still in
+    // cache instead of once per pass over the grid. A row waits until the
+    // row above has had the previous sweep and the row below this one, which
+    // is all Gauss-Seidel reads, so the result is bit-identical to relax's
+    // plain loop. A red-black row's black cells go a step after its red ones,
+    // once the red cells of the row below are done. The boundary ring is
+    // kept per row: the side cells after each row, the bottom and top rows
+    // after rows 1 and ny; the corners, which no stencil reads, come last.
+    template<class T, size_t N, class Update, class VectorUpdate>
+    void relaxBlocked(const std::array<T*, N>& xs, uint32_t iterations, Update&& update,
+                      VectorUpdate&& vectorUpdate) const {
+        // Rows of the fields and about as many of their sources a wavefront spans
+        size_t rowBytes = (size_t) s.stride*sizeof(T)*2*N;
+        uint32_t depth = std::max(1u, std::min(iterations, (uint32_t) (BLOCK_BYTES/(2*rowBytes))));
+        auto finishRow = [&](uint32_t j) {
+            for (T* xp : xs) {
+                FieldView<Shape, T> x{xp, s};
+                x(0, j) = x(1, j);
+                x(s.nx + 1, j) = x(s.nx, j);
+                if (j == 1) for (uint32_t i = 1; i <= s.nx; ++i) x(i, 0) = x(i, 1);
+                if (j == s.ny) for (uint32_t i = 1; i <= s.nx; ++i) x(i, s.ny + 1) = x(i, s.ny);
+            }
+        };
+        bool redBlack = m_order == FluidSolver::RED_BLACK;
+        for (uint32_t done = 0; done < iterations; done += depth) {
+            uint32_t sweeps = std::min(depth, iterations - done);
+            for (uint32_t t = 1; t <= s.ny + 2*sweeps - 1; ++t) {
+                for (uint32_t k = 0; k < sweeps && 2*k < t; ++k) {
+                    uint32_t j = t - 2*k;
+                    if (redBlack) {
+                        if (j <= s.ny) relaxRow(xs, j, 1, s.nx, 0, update, vectorUpdate);
+                        if (j - 1 >= 1 && j - 1 <= s.ny) {
+                            relaxRow(xs, j - 1, 1, s.nx, 1, update, vectorUpdate);
+                            finishRow(j - 1);
+                        }
+                    } else if (j <= s.ny) {
+                        for (uint32_t i = 1; i <= s.nx; ++i) update(i, j, 0);
+                        finishRow(j);
+                    }
+                }
+            }
+        }
+        for (T* x : xs) setBounds(x);
+    }
+
+    template<class T>
+    void writeColors(const FluidSolver::ColorTarget& color, const T* dp, uint32_t j, uint32_t iBegin, uint32_t iEnd) const {
+        FieldView<Shape, const T> d{dp, s};
+        float* out = color.data + (size_t) color.rowStride*j;
+        for (uint32_t i = iBegin; i <= iEnd; ++i) {
+            for (uint32_t k = 0; k < color.components; ++k) {
+                out[(size_t) color.cellStride*i + k] = valueOf(d(i, j));
+            }
+        }
+    }
+
+    template<class T>
+    void writeBorderColors(const FluidSolver::ColorTarget& color, const T* dp) const {
+        writeColors(color, dp, 0, 0, s.nx + 1);
+        writeColors(color, dp, s.ny + 1, 0, s.nx + 1);
+        for (uint32_t j = 1; j <= s.ny; ++j) {
+            writeColors(color, dp, j, 0, 0);
+            writeColors(color, dp, j, s.nx + 1, s.nx + 1);
+        }
+    }
+
+#if FLUID_HAS_SIMD
+    // Vector part of columns [i, iEnd] of one advected row, returns the first column left for the scalar loop
+    template<size_t N>
+    uint32_t advectRowSimd(const std::array<float*, N>& ds, const std::array<const float*, N>& d0s,
+                           const float* velXp, const float* velYp, float dt0, const float* dissolve, uint32_t j,
+                           uint32_t i, uint32_t iEnd) const {
+        using namespace simd;
+        ConstView velX{velXp, s}, velY{velYp, s};
+        const F lo = set1(0.5f), hiX = set1((float) s.nx + 0.5f), hiY = set1((float) s.ny + 0.5f);
+        const F one = set1(1.0f), vdt0 = set1(dt0), y0 = set1((float) j);
+        const F zero = set1(0.0f), two = set1(2.0f), amount = set1(dissolve ? *dissolve : 0.0f);
+
+        for (; i + WIDTH - 1 <= iEnd; i += WIDTH) {
+            F x = min(hiX, max(lo, sub(iota((float) i), mul(vdt0, load(&velX(i, j))))));
+            F y = min(hiY, max(lo, sub(y0, mul(vdt0, load(&velY(i, j))))));
+            I i0 = truncate(x), j0 = truncate(y);
+            F s1 = sub(x, toFloat(i0)), t1 = sub(y, toFloat(j0));
+            F s0 = sub(one, s1), t0 = sub(one, t1);
+
+            I k = index(i0, j0, s.stride);
+            for (size_t c = 0; c < N; ++c) {
+                const float* d0p = d0s[c];
+                F d00 = gather(d0p, k), d01 = gather(d0p, k, s.stride);
+                F d10 = gather(d0p, k, 1), d11 = gather(d0p, k, s.stride + 1);
+                F v = add(mul(s0, add(mul(t0, d00), mul(t1, d01))), mul(s1, add(mul(t0, d10), mul(t1, d11))));
+                if (dissolve) v = min(two, max(zero, sub(v, amount)));
+                store(ds[c] + i + s.stride*j, v);
+            }
+        }
+        return i;
+    }
+
+    // Vector part of a limitedFields row, the same expressions as the scalar loop
+    template<size_t N>
+    uint32_t limitedRowSimd(const std::array<float*, N>& ds, const std::array<const float*, N>& d0s,
+                            const std::array<const float*, N>* forward, const std::array<const float*, N>& backward,
+                            const float* velXp, const float* velYp, float dt0, const float* dissolve, uint32_t j,
+                            uint32_t i, uint32_t iEnd) const {
+        using namespace simd;
+        ConstView velX{velXp, s}, velY{velYp, s};
+        const F lo = set1(0.5f), hiX = set1((float) s.nx + 0.5f), hiY = set1((float) s.ny + 0.5f);
+        const F one = set1(1.0f), half = set1(0.5f), vdt0 = set1(dt0), y0 = set1((float) j);
+        const F zero = set1(0.0f), two = set1(2.0f), amount = set1(dissolve ? *dissolve : 0.0f);
+
+        for (; i + WIDTH - 1 <= iEnd; i += WIDTH) {
+            F x = min(hiX, max(lo, sub(iota((float) i), mul(vdt0, load(&velX(i, j))))));
+            F y = min(hiY, max(lo, sub(y0, mul(vdt0, load(&velY(i, j))))));
+            I i0 = truncate(x), j0 = truncate(y);
+            I k = index(i0, j0, s.stride);
+            F s1, t1, s0, t0;
+            if (!forward) {
+                s1 = sub(x, toFloat(i0));
+                t1 = sub(y, toFloat(j0));
+                s0 = sub(one, s1);
+                t0 = sub(one, t1);
+            }
+
+            size_t at = i + s.stride*j;
+            for (size_t c = 0; c < N; ++c) {
+                const float* d0p = d0s[c];
+                F d00 = gather(d0p, k), d01 = gather(d0p, k, s.stride);
+                F d10 = gather(d0p, k, 1), d11 = gather(d0p, k, s.stride + 1);
+                F low = min(min(d00, d01), min(d10, d11));
+                F high = max(max(d00, d01), max(d10, d11));
+                F v;
+                if (forward) {
+                    v = add(load((*forward)[c] + at), mul(half, sub(load(d0p + at), load(backward[c] + at))));
+                } else {
+                    const float* bp = backward[c];
+                    F b00 = gather(bp, k), b01 = gather(bp, k, s.stride);
+                    F b10 = gather(bp, k, 1), b11 = gather(bp, k, s.stride + 1);
+                    v = add(mul(s0, add(mul(t0, b00), mul(t1, b01))), mul(s1, add(mul(t0, b10), mul(t1, b11))));
+                }
+                v = min(high, max(low, v));
+                if (dissolve) v = min(two, max(zero, sub(v, amount)));
+                store(ds[c] + at, v);
+            }
+        }
+        return i;
+    }
+#endif
+
+    Shape s;
+    ThreadPool* m_pool;
+    RelaxOrder m_order;
+    bool m_simd;
+    const ActiveTiles* m_region;
+    Advection m_advection;
+    const Obstacles* m_obstacles;
+    bool m_blockSweeps;
+};
+
+#endif //FLUIDKERNELS_H
@@ -0,0 +1,374 @@
+#include "FluidSolver.h"
+#include "ConjugateGradient.h"
+#include "Fixed16.h"
+#include "FluidKernels.h"
+#include "Multigrid.h"
+#include "Profiler.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+
+// Interior size of the web canvas (450x810 px at 15 px per cell), which gets
+// a kernel instantiation with compile-time loop bounds and stride.
+#ifndef FLUID_FIXED_CELLS_X
+#define FLUID_FIXED_CELLS_X 29
+#endif
+#ifndef FLUID_FIXED_CELLS_Y
+#define FLUID_FIXED_CELLS_Y 53
+#endif
+
+using FixedShape = FixedGridShape<FLUID_FIXED_CELLS_X, FLUID_FIXED_CELLS_Y>;
+
+FluidSolver::FluidSolver(uint32_t cellsX, uint32_t cellsY)
+    : m_multigrid(std::make_unique<Multigrid>()), m_conjugateGradient(std::make_unique<ConjugateGradient>()) {
+    resize(cellsX, cellsY);
+}
+
+FluidSolver::~FluidSolver() = default;
+
+void FluidSolver::resize(uint32_t cellsX, uint32_t cellsY) {
+    m_cellsX = cellsX;
+    m_cellsY = cellsY;
+    curState.resize(numTilesX(), numTilesY());
+    prevState.resize(numTilesX(), numTilesY());
+    m_tiles.resize(cellsX, cellsY);
+    m_tilesValid = true;
+    obstacles.resize(cellsX, cellsY);
+    for (Field& scratch : m_advectScratch) scratch = Field{};
+    for (Field& pressure : m_lastPressure) pressure = Field{};
+    for (Matrix<uint16_t>& packed : m_packedDensity) packed = Matrix<uint16_t>{};
+}
+
+bool FluidSolver::usesFixedShape() const {
+    return m_cellsX == FixedShape::nx && m_cellsY == FixedShape::ny;
+}
+
+void FluidSolver::setThreadCount(uint32_t threadCount) {
+    if (threadCount == this->threadCount()) return;
+    m_pool = threadCount > 1 ? std::make_unique<ThreadPool>(threadCount) : nullptr;
+}
+
+uint32_t FluidSolver::threadCount() const {
+    return m_pool ? m_pool->size() : 1;
+}
+
+const char* FluidSolver::simdName() {
+    return simd::NAME;
+}
+
+template<class F>
+void FluidSolver::withKernels(F&& f) const {
+    simd::DenormalScope denormals;
+    const ActiveTiles* region = m_sparseStep ? &m_tiles : nullptr;
+    const Obstacles* walls = obstacles.empty() ? nullptr : &obstacles;
+    AdvectionSettings scheme{advection, interpolation, {}};
+    if (advection != SEMI_LAGRANGIAN && m_advectScratch[0].size() == curState.density.size()) {
+        for (size_t k = 0; k < m_advectScratch.size(); ++k) scheme.scratch[k] = m_advectScratch[k].data();
+    }
+    if (usesFixedShape()) {
+        f(FluidKernels<FixedShape>(FixedShape{}, m_pool.get(), relaxation, simd, region, scheme, walls, blockedSweeps));
+    } else {
+        f(FluidKernels<GridShape>(GridShape{m_cellsX, m_cellsY, curState.density.stride()}, m_pool.get(), relaxation,
+                                  simd, region, scheme, walls, blockedSweeps));
+    }
+}
+
+void FluidSolver::reset() {
+    curState.density.fill(0.0f);
+    curState.velX.fill(0.0f);
+    curState.velY.fill(0.0f);
+    prevState.density.fill(0.0f);
+    prevState.velX.fill(0.0f);
+    prevState.velY.fill(0.0f);
+    for (Field& scratch : m_advectScratch) scratch.fill(0.0f);
+    for (Field& pressure : m_lastPressure) pressure = Field{};
+    for (Matrix<uint16_t>& packed : m_packedDensity) packed.fill(0);
+    m_tiles.clear();
+    m_tilesValid = true;
+}
+
+void FluidSolver::step(float deltaTime) {
+    PROFILE_SCOPE("step");
+    if (densityStorage == FIXED16 && !m_packedDensity[0].size()) {
+        for (Matrix<uint16_t>& packed : m_packedDensity) {
+            packed.resize(curState.density.stride(), curState.density.height());
+        }
+        packDensity();
+    } else if (densityStorage == FLOAT32 && m_packedDensity[0].size()) {
+        unpackDensity();
+        for (Matrix<uint16_t>& packed : m_packedDensity) packed = Matrix<uint16_t>{};
+    }
+    if (advection != SEMI_LAGRANGIAN && m_advectScratch[0].size() != curState.density.size()) {
+        for (Field& scratch : m_advectScratch) {
+            scratch.resize(numTilesX(), numTilesY());
+            scratch.fill(0.0f);
+        }
+    }
+    // Custom forces run before the region is fixed, so the tiles they wake take part
+    if (forces) forces(*this, deltaTime);
+    obstacles.update();
+    bool sparse = sparseTiles && pressureSolver == GAUSS_SEIDEL;
+    if (sparse) {
+        // After dense steps anything can be anywhere
+        if (!m_tilesValid) m_tiles.markAll();
+        // The wall passes write solid cells and read them back wherever they
+        // are, so their tiles never go idle
+        for (const Obstacles::Cell& cell : obstacles.boundary()) {
+            m_tiles.mark(cell.index % obstacles.stride(), cell.index/obstacles.stride());
+        }
+        m_tiles.buildRegion();
+        m_sparseStep = true;
+    }
+
+    applyForces(deltaTime);
+    updateVelocities(deltaTime);
+    updateDensities(deltaTime);
+    if (!fusedStep) dissolve(deltaTime);
+
+    if (sparse) {
+        m_sparseStep = false;
+        retireIdleTiles();
+    }
+    m_tilesValid = sparse;
+}
+
+void FluidSolver::retireIdleTiles() {
+    PROFILE_SCOPE("retireTiles");
+    Field* fields[] = {&curState.density, &curState.velX, &curState.velY,
+                       &prevState.density, &prevState.velX, &prevState.velY,
+                       &m_advectScratch[0], &m_advectScratch[1], &m_advectScratch[2], &m_advectScratch[3]};
+    const ColorTarget* color = colorTarget.data ? &colorTarget : nullptr;
+    uint32_t lastX = m_cellsX + 1, lastY = m_cellsY + 1;
+    uint32_t stride = curState.density.stride();
+    const uint16_t* packed = m_packedDensity[0].data();
+
+    m_tiles.update(sparseThreshold, [&](uint32_t i0, uint32_t i1, uint32_t j0, uint32_t j1) {
+        float maxAbs = 0.0f;
+        for (uint32_t j = j0; j <= j1; ++j) {
+            for (uint32_t i = i0; i <= i1; ++i) {
+                float density = packed ? fixed16::toFloat(packed[i + stride*j]) : std::abs(curState.density(i, j));
+                maxAbs = std::max({maxAbs, density, std::abs(curState.velX(i, j)), std::abs(curState.velY(i, j))});
+            }
+        }
+        return maxAbs;
+    }, [&](uint32_t i0, uint32_t i1, uint32_t j0, uint32_t j1) {
+        // Boundary cells next to the tile go too, they only mirror it
+        if (i0 == 1) i0 = 0;
+        if (j0 == 1) j0 = 0;
+        if (i1 == m_cellsX) i1 = lastX;
+        if (j1 == m_cellsY) j1 = lastY;
+        for (uint32_t j = j0; j <= j1; ++j) {
+            for (Field* field : fields) {
+                if (field->size()) std::fill(&(*field)(i0, j), &(*field)(i1, j) + 1, 0.0f);
+            }
+            for (Matrix<uint16_t>& field : m_packedDensity) {
+                if (field.size()) std::fill_n(field.data() + i0 + stride*j, i1 - i0 + 1, 0);
+            }
+            if (!color) continue;
+            float* out = color->data + (size_t) color->rowStride*j;
+            for (uint32_t i = i0; i <= i1; ++i) {
+                std::fill_n(out + (size_t) color->cellStride*i, color->components, 0.0f);
+            }
+        }
+    });
+}
+
+uint32_t FluidSolver::advance(float deltaTime) {
+    uint32_t substeps = 1;
+    if (maxCfl > 0.0f) {
+        float cfl = cflNumber(deltaTime);
+        substeps = std::min(std::max(1u, (uint32_t) std::ceil(cfl/maxCfl)), std::max(1u, maxSubsteps));
+        PROFILE_COUNTER("cfl", cfl);
+    }
+    for (uint32_t k = 0; k < substeps; ++k) step(deltaTime/(float) substeps);
+    return substeps;
+}
+
+float FluidSolver::maxVelocity() const {
+    float result = 0.0f;
+    withKernels([&](const auto& k) { result = k.maxVelocity(curState.velX.data(), curState.velY.data()); });
+    return result;
+}
+
+float FluidSolver::cflNumber(float deltaTime) const {
+    // advect backtraces dt*min(nx, ny)*v cells along each axis
+    return deltaTime*(float) std::min(m_cellsX, m_cellsY)*maxVelocity();
+}
+
+void FluidSolver::addDensity(uint32_t i, uint32_t j, float amount) {
+    if (m_packedDensity[0].size()) {
+        uint16_t& code = m_packedDensity[0][i + curState.density.stride()*j];
+        code = fixed16::fromFloat(fixed16::toFloat(code) + amount);
+    } else {
+        curState.density(i, j) += amount;
+    }
+    markActive(i, j);
+}
+
+void FluidSolver::packDensity() {
+    if (!m_packedDensity[0].size()) return;
+    fixed16::pack(curState.density.data(), m_packedDensity[0].data(), curState.density.size());
+    fixed16::pack(prevState.density.data(), m_packedDensity[1].data(), prevState.density.size());
+}
+
+void FluidSolver::unpackDensity() {
+    if (!m_packedDensity[0].size()) return;
+    fixed16::unpack(m_packedDensity[0].data(), curState.density.data(), curState.density.size());
+    fixed16::unpack(m_packedDensity[1].data(), prevState.density.data(), prevState.density.size());
+}
+
+void FluidSolver::setVelocity(uint32_t i, uint32_t j, float vx, float vy) {
+    curState.velX(i, j) = vx;
+    curState.velY(i, j) = vy;
+    markActive(i, j);
+}
+
+void FluidSolver::applyForces(float deltaTime) {
+    if (vorticity == 0.0f && buoyancy == 0.0f) return;
+    PROFILE_SCOPE("forces");
+    // The previous velocities are free until updateVelocities, the forced
+    // velocity goes there and the two swap
+    withKernels([&](const auto& k) {
+        if (m_packedDensity[0].size()) {
+            k.applyForces(curState.velX.data(), curState.velY.data(), m_packedDensity[0].data(), prevState.velX.data(),
+                          prevState.velY.data(), deltaTime, vorticity, buoyancy);
+        } else {
+            k.applyForces(curState.velX.data(), curState.velY.data(), curState.density.data(), prevState.velX.data(),
+                          prevState.velY.data(), deltaTime, vorticity, buoyancy);
+        }
+        curState.velX.swap(prevState.velX);
+        curState.velY.swap(prevState.velY);
+        k.setBounds(curState.velX.data(), MIRROR_X);
+        k.setBounds(curState.velY.data(), MIRROR_Y);
+    });
+}
+
+void FluidSolver::updateDensities(float deltaTime) {
+    PROFILE_SCOPE("densities");
+    if (m_packedDensity[0].size()) {
+        updatePackedDensities(deltaTime);
+        return;
+    }
+    curState.density.swap(prevState.density);
+    diffuse(curState.density, prevState.density, diffusionFactor, deltaTime);
+    curState.density.swap(prevState.density);
+    if (fusedStep) {
+        // Dissolve and colour output ride along with advection
+        float amount = deltaTime*dissolveFactor;
+        const ColorTarget* color = colorTarget.data ? &colorTarget : nullptr;
+        withKernels([&](const auto& k) {
+            k.advect(curState.density.data(), prevState.density.data(), curState.velX.data(), curState.velY.data(),
+                     deltaTime, REGULAR, &amount, color);
+        });
+    } else {
+        advect(curState.density, prevState.density, curState.velX, curState.velY, deltaTime);
+    }
+}
+
+// updateDensities on the fixed point density: the same passes, without the
+// swaps, as diffusion can go straight into the previous density
+void FluidSolver::updatePackedDensities(float deltaTime) {
+    Matrix<uint16_t>& cur = m_packedDensity[0];
+    Matrix<uint16_t>& prev = m_packedDensity[1];
+    float amount = deltaTime*dissolveFactor;
+    const float* dissolve = fusedStep ? &amount : nullptr;
+    const ColorTarget* color = fusedStep && colorTarget.data ? &colorTarget : nullptr;
+    withKernels([&](const auto& k) {
+        k.diffusePacked(prev.data(), cur.data(), diffusionFactor, deltaTime);
+        if (advection == SEMI_LAGRANGIAN && interpolation == BILINEAR) {
+            k.advectPacked(cur.data(), prev.data(), curState.velX.data(), curState.velY.data(), deltaTime, dissolve, color);
+            return;
+        }
+        // The other schemes only have float kernels
+        fixed16::unpack(prev.data(), prevState.density.data(), prevState.density.size());
+        k.advect(curState.density.data(), prevState.density.data(), curState.velX.data(), curState.velY.data(),
+                 deltaTime, REGULAR, dissolve, color);
+        fixed16::pack(curState.density.data(), cur.data(), curState.density.size());
+    });
+}
+
+void FluidSolver::updateVelocities(float deltaTime) {
+    PROFILE_SCOPE("velocities");
+    curState.velX.swap(prevState.velX);
+    curState.velY.swap(prevState.velY);
+    if (fusedStep) {
+        withKernels([&](const auto& k) {
+            k.diffuseVelocity(curState.velX.data(), curState.velY.data(), prevState.velX.data(), prevState.velY.data(),
+                              viscosity, deltaTime);
+        });
+    } else {
+        diffuse(curState.velX, prevState.velX, viscosity, deltaTime);
+        diffuse(curState.velY, prevState.velY, viscosity, deltaTime);
+    }
+
+    project(curState.velX, curState.velY, prevState.velX, prevState.velY);
+
+    curState.velX.swap(prevState.velX);
+    curState.velY.swap(prevState.velY);
+    if (fusedStep) {
+        withKernels([&](const auto& k) {
+            k.advectVelocity(curState.velX.data(), curState.velY.data(), prevState.velX.data(), prevState.velY.data(), deltaTime);
+        });
+    } else {
+        advect(curState.velX, prevState.velX, prevState.velX, prevState.velY, deltaTime, MIRROR_X);
+        advect(curState.velY, prevState.velY, prevState.velX, prevState.velY, deltaTime, MIRROR_Y);
+    }
+
+    project(curState.velX, curState.velY, prevState.velX, prevState.velY);
+}
+
+void FluidSolver::dissolve(float deltaTime) {
+    const ColorTarget* color = colorTarget.data ? &colorTarget : nullptr;
+    withKernels([&](const auto& k) {
+        if (m_packedDensity[0].size()) {
+            k.dissolve(m_packedDensity[0].data(), deltaTime*dissolveFactor, color);
+        } else {
+            k.dissolve(curState.density.data(), deltaTime*dissolveFactor, color);
+        }
+    });
+}
+
+void FluidSolver::diffuse(Field& x, const Field& x0, float diff, float dt) const {
+    withKernels([&](const auto& k) { k.diffuse(x.data(), x0.data(), diff, dt); });
+}
+
+void FluidSolver::advect(Field& d, const Field& d0, const Field& velX, const Field& velY, float dt, BoundConfig b) const {
+    withKernels([&](const auto& k) { k.advect(d.data(), d0.data(), velX.data(), velY.data(), dt, b); });
+}
+
+void FluidSolver::project(Field& velX, Field& velY, Field& div, Field& p) {
+    PROFILE_SCOPE("project");
+    withKernels([&](const auto& k) {
+        k.divergence(velX.data(), velY.data(), div.data(), p.data());
+
+        if (pressureSolver != GAUSS_SEIDEL) {
+            Field& last = m_lastPressure[m_projections++ & 1];
+            if (warmStart && last.size() == p.size()) p = last;
+            GridShape shape{m_cellsX, m_cellsY, p.stride()};
+            if (pressureSolver == MULTIGRID) {
+                auto result = m_multigrid->solve(shape, p.data(), div.data(), pressureTolerance, pressureIterations,
+                                                 m_pool.get(), relaxation, simd, &obstacles);
+                lastPressureStats = {result.cycles, result.residual};
+            } else {
+                auto result = m_conjugateGradient->solve(shape, p.data(), div.data(), pressureTolerance,
+                                                         pressureIterations, m_pool.get(), simd, &obstacles);
+                lastPressureStats = {result.iterations, result.residual};
+            }
+            // The solid cells have no equation; they get their display values here
+            if (!obstacles.empty()) k.setBounds(p.data());
+            if (warmStart) last = p;
+        } else {
+            k.relaxPressure(p.data(), div.data(), pressureIterations);
+            lastPressureStats = {pressureIterations, -1.0f};
+        }
+        PROFILE_COUNTER("pressure iterations", lastPressureStats.iterations);
+        if (lastPressureStats.residual >= 0.0f) PROFILE_COUNTER("pressure residual", lastPressureStats.residual);
+
+        k.subtractGradient(velX.data(), velY.data(), p.data());
+    });
+}
+
+void FluidSolver::setBounds(Field& x, BoundConfig b) const {
+    withKernels([&](const auto& k) { k.setBounds(x.data(), b); });
+}
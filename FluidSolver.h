@@ -0,0 +1,216 @@
+#ifndef FLUIDSOLVER_H
+#define FLUIDSOLVER_H
+
+#include "ActiveTiles.h"
+#include "Matrix.h"
+#include "Obstacles.h"
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+class ConjugateGradient;
+class Multigrid;
+class ThreadPool;
+
+// Stam's stable-fluids solver without any window or GL state, so it can be
+// stepped by the viewer as well as by headless tools.
+class FluidSolver {
+public:
+    using Field = Matrix<float>;
+
+    struct FluidData {
+        Field density{}, velX{}, velY{};
+
+        void resize(uint32_t width, uint32_t height) {
+            density.resize(width, height);
+            velX.resize(width, height);
+            velY.resize(width, height);
+        }
+    };
+
+    enum BoundConfig {
+        REGULAR, MIRROR_X, MIRROR_Y
+    };
+
+    enum PressureSolver {
+        GAUSS_SEIDEL,      // fixed number of sweeps, fine for small grids
+        MULTIGRID,         // V-cycles until the relative residual drops below pressureTolerance
+        CONJUGATE_GRADIENT // MIC(0) preconditioned CG iterations, same stopping rule
+    };
+
+    enum RelaxOrder {
+        LEXICOGRAPHIC, // the classic serial Gauss-Seidel sweep
+        RED_BLACK      // checkerboard sweep, parallel and deterministic
+    };
+
+    enum AdvectionScheme {
+        SEMI_LAGRANGIAN, // one backtrace, first order and diffusive
+        MACCORMACK,      // forward and backward trace, corrected by half the round-trip error
+        BFECC            // the source corrected by that error, traced again
+    };
+
+    enum Interpolation {
+        BILINEAR,
+        MONOTONIC_CUBIC  // 4x4 cells, slopes limited so no new extrema appear
+    };
+
+    enum DensityStorage {
+        FLOAT32,
+        FIXED16 // 16-bit fixed point code of density in [0, 4], see Fixed16.h
+    };
+
+    // Where display colours go: the density of cell (i, j) is written to
+    // components consecutive floats at data[i*cellStride + j*rowStride]
+    struct ColorTarget {
+        float* data = nullptr;
+        uint32_t cellStride = 1, rowStride = 0, components = 1;
+    };
+
+    struct PressureStats {
+        uint32_t iterations = 0; // sweeps, cycles or CG iterations of the last pressure solve
+        float residual = -1.0f;  // relative residual, negative when not measured
+    };
+
+    // cellsX/cellsY count the interior cells; fields carry an extra boundary ring
+    FluidSolver(uint32_t cellsX, uint32_t cellsY);
+    FluidSolver(const FluidSolver &) = delete;
+    FluidSolver &operator=(const FluidSolver &) = delete;
+    ~FluidSolver();
+
+    void resize(uint32_t cellsX, uint32_t cellsY);
+    uint32_t numTilesX() const { return m_cellsX + 2; }
+    uint32_t numTilesY() const { return m_cellsY + 2; }
+    uint32_t numTilesMiddleX() const { return m_cellsX; }
+    uint32_t numTilesMiddleY() const { return m_cellsY; }
+    // True when the grid matches the compile-time specialised size
+    bool usesFixedShape() const;
+
+    // Number of threads the kernels run on, the caller included. Workers are
+    // created here and reused by every step.
+    void setThreadCount(uint32_t threadCount);
+    uint32_t threadCount() const;
+    // Instruction set the vector kernels were built for, "scalar" if none
+    static const char* simdName();
+
+    void reset();
+    void step(float deltaTime);
+    // Steps deltaTime in equal substeps so that advection backtraces at most
+    // maxCfl cells, with no more than maxSubsteps of them; a single step when
+    // maxCfl is 0. Returns the number of substeps taken.
+    uint32_t advance(float deltaTime);
+    // Largest velocity component and the CFL number a step of deltaTime would have
+    float maxVelocity() const;
+    float cflNumber(float deltaTime) const;
+
+    void addDensity(uint32_t i, uint32_t j, float amount);
+    void setVelocity(uint32_t i, uint32_t j, float vx, float vy);
+    // Wakes the tile of cell (i, j) for sparse steps, for code writing the fields directly
+    void markActive(uint32_t i, uint32_t j) { m_tiles.mark(std::clamp(i, 1u, m_cellsX), std::clamp(j, 1u, m_cellsY)); }
+    void markAllActive() { m_tiles.markAll(); }
+
+    // Force stage at the start of a step, before updateVelocities
+    void applyForces(float deltaTime);
+    void updateDensities(float deltaTime);
+    void updateVelocities(float deltaTime);
+    void dissolve(float deltaTime);
+
+    void diffuse(Field& x, const Field& x0, float diff, float dt) const;
+    void advect(Field& d, const Field& d0, const Field& velX, const Field& velY, float dt, BoundConfig b = REGULAR) const;
+    void project(Field& velX, Field& velY, Field& div, Field& p);
+    void setBounds(Field& x, BoundConfig b = REGULAR) const;
+
+    FluidData curState, prevState;
+    // Solid cells inside the grid; mask changes take effect at the next step
+    Obstacles obstacles;
+    float viscosity = 0.005f, diffusionFactor = 0.001f, dissolveFactor = 0.02f;
+
+    // Fused kernels: both velocity components diffused and advected in one
+    // pass, dissolve and the colour write folded into density advection
+    bool fusedStep = true;
+    // Filled with the density at the end of every step when data is set
+    ColorTarget colorTarget{};
+
+    // Vorticity confinement gives back the swirls that numerical diffusion
+    // takes, so small grids stay lively; vorticity is its strength, 0 turns
+    // it off. Buoyancy accelerates the smoke upwards by buoyancy*density.
+    float vorticity = 0.0f, buoyancy = 0.0f;
+    // Further forces, called first thing in every step; sparse steps need
+    // the cells they touch marked with markActive
+    std::function<void(FluidSolver&, float deltaTime)> forces;
+
+    // The corrected schemes clamp to the cells around the backtrace and cost
+    // about three advections; both keep detail that semi-Lagrangian
+    // advection would need a much finer grid for
+    AdvectionScheme advection = SEMI_LAGRANGIAN;
+    Interpolation interpolation = BILINEAR;
+
+    RelaxOrder relaxation = LEXICOGRAPHIC;
+    // Run the diffusion and pressure sweeps as a wavefront over a window of
+    // rows that stays in cache, several sweeps per pass over the grid. Same
+    // results; off by default, and only used single-threaded, without sparse
+    // tiles or obstacles.
+    bool blockedSweeps = false;
+    // Use the vector kernels when the build has them (see Simd.h)
+    bool simd = true;
+    PressureSolver pressureSolver = GAUSS_SEIDEL;
+    // Gauss-Seidel sweeps, or the cap on V-cycles / CG iterations
+    uint32_t pressureIterations = 20;
+    float pressureTolerance = 1e-3f;
+    // Multigrid and CG start from the pressure each projection of the step
+    // found last time instead of zero
+    bool warmStart = true;
+    PressureStats lastPressureStats{};
+
+    float maxCfl = 0.0f;
+    uint32_t maxSubsteps = 4;
+
+    // With FIXED16 the density is kept in 16-bit fixed point from one step to
+    // the next, half the bytes of float; the kernels accumulate in float and
+    // round each value they store. The next step packs the float density it
+    // finds when the option is turned on and unpacks it when turned off.
+    // Meanwhile curState.density and prevState.density are a float copy that
+    // is only up to date after unpackDensity(), and edits made to them need
+    // packDensity(); addDensity works either way. The corrected advection
+    // schemes and cubic interpolation advect an unpacked copy.
+    DensityStorage densityStorage = FLOAT32;
+    // Both no-ops unless the density is held packed
+    void packDensity();
+    void unpackDensity();
+
+    // Steps only touch the 16x16 tiles holding density or velocity above
+    // sparseThreshold and the tiles around them; the rest of the grid is
+    // cleared when it falls below the threshold and skipped. Tiles with wall
+    // cells are always stepped. Not used with the multigrid or CG solvers,
+    // whose pressure reaches the whole grid.
+    bool sparseTiles = false;
+    float sparseThreshold = 1e-4f;
+    const ActiveTiles& activeTiles() const { return m_tiles; }
+
+private:
+    template<class F> void withKernels(F&& f) const;
+    void updatePackedDensities(float deltaTime);
+    void retireIdleTiles();
+
+    uint32_t m_cellsX = 0, m_cellsY = 0;
+    std::unique_ptr<Multigrid> m_multigrid;
+    std::unique_ptr<ConjugateGradient> m_conjugateGradient;
+    // Last pressure of the projection after diffusion and the one after
+    // advection, the warm starts of the next step's solves
+    std::array<Field, 2> m_lastPressure;
+    uint32_t m_projections = 0;
+    std::unique_ptr<ThreadPool> m_pool;
+    ActiveTiles m_tiles;
+    // True while a sparse step runs, the kernels then only visit the region
+    bool m_sparseStep = false;
+    // Whether the tile flags describe the fields; they do not after a dense step
+    bool m_tilesValid = false;
+    // Forward and backward traces of the corrected advection schemes, two
+    // per advected field. Zero outside the region like the state.
+    mutable std::array<Field, 4> m_advectScratch;
+    // Current and previous density while densityStorage is FIXED16, empty
+    // otherwise. Indexed with the float fields' stride, like the kernels do.
+    std::array<Matrix<uint16_t>, 2> m_packedDensity;
+};
+
+#endif //FLUIDSOLVER_H
@@ -68,7 +68,11 @@ void Grid2D::updateColor(uint32_t idx, float color) {
 }
 
 void Grid2D::updateBuffer() {
-    glBufferData(GL_ARRAY_BUFFER, m_vertices.size()*sizeof(Vertex), m_vertices.data(), GL_DYNAMIC_DRAW);
+    // Orphan the storage the previous draw may still be reading so the upload
+    // does not wait for it, then fill the fresh one
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, m_vertices.size()*sizeof(Vertex), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, m_vertices.size()*sizeof(Vertex), m_vertices.data());
 }
 
 void Grid2D::render() {
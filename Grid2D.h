@@ -35,6 +35,9 @@ public:
     void updateBuffer();
     void render();
     size_t size() { return m_vertices.size(); }
+    // Colour of the first vertex; vertices are VERTEX_FLOATS floats apart
+    float* colorData() { return m_vertices.empty() ? nullptr : m_vertices[0].col; }
+    static constexpr uint32_t VERTEX_FLOATS = sizeof(Vertex)/sizeof(GLfloat);
 
 private:
 
@@ -0,0 +1,30 @@
+#ifndef GRIDSHAPE_H
+#define GRIDSHAPE_H
+
+#include "Matrix.h"
+#include <cstdint>
+
+// Loop bounds and row stride of a field. GridShape is filled at runtime;
+// FixedGridShape bakes them in so small grids get fully constant-folded loops.
+struct GridShape {
+    uint32_t nx, ny, stride;
+};
+
+template<uint32_t NX, uint32_t NY>
+struct FixedGridShape {
+    static constexpr uint32_t nx = NX;
+    static constexpr uint32_t ny = NY;
+    static constexpr uint32_t stride = Matrix<float>::paddedStride(NX + 2);
+};
+
+template<class Shape, class T = float>
+struct FieldView {
+    T* data;
+    Shape s;
+
+    T& operator()(uint32_t i, uint32_t j) const {
+        return data[i + s.stride*j];
+    }
+};
+
+#endif //GRIDSHAPE_H
@@ -0,0 +1,65 @@
+#ifndef HALF_H
+#define HALF_H
+
+#include <cstdint>
+#include <cstring>
+
+// IEEE 754 binary16 conversions in plain C++, rounding to nearest even.
+// Values beyond the half range become infinities, tiny ones denormals or zero.
+namespace half {
+    inline uint16_t fromFloat(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        uint32_t sign = (bits >> 16) & 0x8000u;
+        uint32_t exponent = (bits >> 23) & 0xffu;
+        uint32_t mantissa = bits & 0x7fffffu;
+
+        if (exponent == 0xff) return (uint16_t) (sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+        int e = (int) exponent - 127 + 15;
+        if (e >= 31) return (uint16_t) (sign | 0x7c00u);
+        if (e <= 0) {
+            if (e < -10) return (uint16_t) sign;
+            // Denormal half: shift the mantissa with its implicit bit in
+            mantissa |= 0x800000u;
+            uint32_t shift = (uint32_t) (14 - e);
+            uint32_t result = mantissa >> shift;
+            uint32_t rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+            if (rest > halfway || (rest == halfway && (result & 1u))) result++;
+            return (uint16_t) (sign | result);
+        }
+        uint32_t result = ((uint32_t) e << 10) | (mantissa >> 13);
+        uint32_t rest = mantissa & 0x1fffu;
+        // A carry out of the mantissa bumps the exponent, up to infinity
+        if (rest > 0x1000u || (rest == 0x1000u && (result & 1u))) result++;
+        return (uint16_t) (sign | result);
+    }
+
+    inline float toFloat(uint16_t value) {
+        uint32_t sign = (uint32_t) (value & 0x8000u) << 16;
+        uint32_t exponent = (value >> 10) & 0x1fu;
+        uint32_t mantissa = value & 0x3ffu;
+        uint32_t bits;
+        if (exponent == 0x1f) {
+            bits = sign | 0x7f800000u | (mantissa << 13);
+        } else if (exponent == 0) {
+            if (mantissa == 0) {
+                bits = sign;
+            } else {
+                // Normalise the half denormal
+                int e = -1;
+                do {
+                    e++;
+                    mantissa <<= 1;
+                } while (!(mantissa & 0x400u));
+                bits = sign | ((uint32_t) (127 - 15 - e) << 23) | ((mantissa & 0x3ffu) << 13);
+            }
+        } else {
+            bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+        }
+        float result;
+        std::memcpy(&result, &bits, sizeof(result));
+        return result;
+    }
+}
+
+#endif //HALF_H
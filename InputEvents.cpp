@@ -0,0 +1,267 @@
+#include "InputEvents.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+void InputForces::handle(const InputEvent& event) {
+    switch (event.type) {
+        case InputEvent::POINTER_MOVE:
+            m_x = event.x;
+            m_y = event.y;
+            m_hasPointer = true;
+            break;
+        case InputEvent::POINTER_DOWN: m_pressed = true; break;
+        case InputEvent::POINTER_UP: m_pressed = false; break;
+        case InputEvent::TOUCH: m_touches.push_back(event); break;
+        case InputEvent::WALL_DOWN:
+            m_drawing = true;
+            m_hasWallCell = false;
+            break;
+        case InputEvent::WALL_UP: m_drawing = false; break;
+    }
+}
+
+void InputForces::apply(FluidSolver& solver, float deltaTime) {
+    // The border cells sit on the canvas edges, one canvas step apart from
+    // their neighbours like the vertices of the mesh
+    auto cellX = [&](float x) { return (uint32_t) ((double) x*(solver.numTilesX() - 1)/m_width); };
+    auto cellY = [&](float y) { return (uint32_t) ((double) y*(solver.numTilesY() - 1)/m_height); };
+
+    if (m_hasPointer && inside(m_x, m_y) && m_drawing) {
+        drawWall(solver, cellX(m_x), cellY(m_y));
+    } else if (m_hasPointer && inside(m_x, m_y)) {
+        auto i = cellX(m_x), j = cellY(m_y);
+        if (m_pressed) solver.addDensity(i, j, mouseDensity);
+        solver.setVelocity(i, j, mouseSpeed*deltaTime*(m_x - m_prevX), mouseSpeed*deltaTime*(m_y - m_prevY));
+        m_prevX = m_x;
+        m_prevY = m_y;
+    }
+    for (const InputEvent& touch : m_touches) {
+        if (!inside(touch.x, touch.y)) continue;
+        auto i = cellX(touch.x), j = cellY(touch.y);
+        solver.addDensity(i, j, touchDensity);
+        solver.setVelocity(i, j, touchSpeed*deltaTime*(touch.x - m_prevTouchX),
+                           touchSpeed*deltaTime*(touch.y - m_prevTouchY));
+        m_prevTouchX = touch.x;
+        m_prevTouchY = touch.y;
+    }
+    m_touches.clear();
+}
+
+void InputForces::drawWall(FluidSolver& solver, uint32_t i, uint32_t j) {
+    if (!m_hasWallCell) {
+        m_wallI = i;
+        m_wallJ = j;
+        m_hasWallCell = true;
+    }
+    auto x = (int64_t) m_wallI, y = (int64_t) m_wallJ;
+    int64_t dx = std::abs((int64_t) i - x), dy = -std::abs((int64_t) j - y);
+    int64_t sx = x < (int64_t) i ? 1 : -1, sy = y < (int64_t) j ? 1 : -1;
+    int64_t error = dx + dy;
+    solver.obstacles.set((uint32_t) x, (uint32_t) y, true);
+    while (x != (int64_t) i || y != (int64_t) j) {
+        if (2*error - dy > dx - 2*error) {
+            error += dy;
+            x += sx;
+        } else {
+            error += dx;
+            y += sy;
+        }
+        solver.obstacles.set((uint32_t) x, (uint32_t) y, true);
+    }
+    m_wallI = i;
+    m_wallJ = j;
+}
+
+InputLog::Settings InputLog::settingsOf(const FluidSolver& solver, const FixedTimestep& timestep, float canvasWidth,
+                                        float canvasHeight) {
+    Settings settings;
+    settings.cellsX = solver.numTilesX() - 2;
+    settings.cellsY = solver.numTilesY() - 2;
+    settings.canvasWidth = canvasWidth;
+    settings.canvasHeight = canvasHeight;
+    settings.stepSize = timestep.stepSize();
+    settings.maxSteps = timestep.maxSteps;
+    settings.maxCfl = solver.maxCfl;
+    settings.maxSubsteps = solver.maxSubsteps;
+    settings.sparseTiles = solver.sparseTiles;
+    settings.viscosity = solver.viscosity;
+    settings.diffusionFactor = solver.diffusionFactor;
+    settings.dissolveFactor = solver.dissolveFactor;
+    settings.advection = solver.advection;
+    settings.interpolation = solver.interpolation;
+    settings.vorticity = solver.vorticity;
+    settings.buoyancy = solver.buoyancy;
+    for (uint32_t j = 1; j <= solver.numTilesMiddleY(); ++j) {
+        for (uint32_t i = 1; i <= solver.numTilesMiddleX(); ++i) {
+            if (!solver.obstacles.solid(i, j)) continue;
+            uint32_t first = i;
+            while (i < solver.numTilesMiddleX() && solver.obstacles.solid(i + 1, j)) ++i;
+            settings.solidRuns.insert(settings.solidRuns.end(), {j, first, i});
+        }
+    }
+    return settings;
+}
+
+void InputLog::apply(const Settings& settings, FluidSolver& solver, FixedTimestep& timestep) {
+    solver.resize(settings.cellsX, settings.cellsY);
+    solver.maxCfl = settings.maxCfl;
+    solver.maxSubsteps = settings.maxSubsteps;
+    solver.sparseTiles = settings.sparseTiles;
+    solver.viscosity = settings.viscosity;
+    solver.diffusionFactor = settings.diffusionFactor;
+    solver.dissolveFactor = settings.dissolveFactor;
+    solver.advection = settings.advection;
+    solver.interpolation = settings.interpolation;
+    solver.vorticity = settings.vorticity;
+    solver.buoyancy = settings.buoyancy;
+    for (size_t k = 0; k + 2 < settings.solidRuns.size(); k += 3) {
+        for (uint32_t i = settings.solidRuns[k + 1]; i <= settings.solidRuns[k + 2]; ++i) {
+            solver.obstacles.set(i, settings.solidRuns[k], true);
+        }
+    }
+    timestep.setStepSize(settings.stepSize);
+    timestep.maxSteps = settings.maxSteps;
+}
+
+static const char* eventName(InputEvent::Type type) {
+    switch (type) {
+        case InputEvent::POINTER_MOVE: return "move";
+        case InputEvent::POINTER_DOWN: return "down";
+        case InputEvent::POINTER_UP: return "up";
+        case InputEvent::TOUCH: return "touch";
+        case InputEvent::WALL_DOWN: return "wall-down";
+        case InputEvent::WALL_UP: return "wall-up";
+    }
+    return "";
+}
+
+bool InputLog::load(const std::string& path) {
+    std::FILE* file = std::fopen(path.c_str(), "r");
+    if (!file) {
+        std::cerr << "Cannot open " << path << std::endl;
+        return false;
+    }
+    m_settings = {};
+    m_frames.clear();
+
+    char line[256], name[32];
+    unsigned version = 0, sparse = 0;
+    bool ok = std::fgets(line, sizeof(line), file) && std::sscanf(line, "fluid-input %u", &version) == 1
+              && (version == 1 || version == 2);
+    for (uint32_t number = 2; ok && std::fgets(line, sizeof(line), file); ++number) {
+        InputEvent event{};
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (std::sscanf(line, "%31s", name) != 1) continue;
+        bool parsed = true;
+        if (!std::strcmp(name, "cells")) {
+            parsed = std::sscanf(line, "%*s %u %u", &m_settings.cellsX, &m_settings.cellsY) == 2;
+        } else if (!std::strcmp(name, "canvas")) {
+            parsed = std::sscanf(line, "%*s %f %f", &m_settings.canvasWidth, &m_settings.canvasHeight) == 2;
+        } else if (!std::strcmp(name, "step-size")) {
+            parsed = std::sscanf(line, "%*s %f", &m_settings.stepSize) == 1;
+        } else if (!std::strcmp(name, "max-steps")) {
+            parsed = std::sscanf(line, "%*s %u", &m_settings.maxSteps) == 1;
+        } else if (!std::strcmp(name, "max-cfl")) {
+            parsed = std::sscanf(line, "%*s %f", &m_settings.maxCfl) == 1;
+        } else if (!std::strcmp(name, "max-substeps")) {
+            parsed = std::sscanf(line, "%*s %u", &m_settings.maxSubsteps) == 1;
+        } else if (!std::strcmp(name, "sparse")) {
+            parsed = std::sscanf(line, "%*s %u", &sparse) == 1;
+            m_settings.sparseTiles = sparse != 0;
+        } else if (!std::strcmp(name, "params")) {
+            parsed = std::sscanf(line, "%*s %f %f %f", &m_settings.viscosity, &m_settings.diffusionFactor,
+                                 &m_settings.dissolveFactor) == 3;
+        } else if (!std::strcmp(name, "advection")) {
+            unsigned scheme, interpolation;
+            parsed = std::sscanf(line, "%*s %u %u", &scheme, &interpolation) == 2 && scheme <= FluidSolver::BFECC
+                     && interpolation <= FluidSolver::MONOTONIC_CUBIC;
+            if (parsed) {
+                m_settings.advection = (FluidSolver::AdvectionScheme) scheme;
+                m_settings.interpolation = (FluidSolver::Interpolation) interpolation;
+            }
+        } else if (!std::strcmp(name, "forces")) {
+            parsed = std::sscanf(line, "%*s %f %f", &m_settings.vorticity, &m_settings.buoyancy) == 2;
+        } else if (!std::strcmp(name, "solid")) {
+            uint32_t j, first, last;
+            parsed = std::sscanf(line, "%*s %u %u %u", &j, &first, &last) == 3;
+            m_settings.solidRuns.insert(m_settings.solidRuns.end(), {j, first, last});
+        } else if (!std::strcmp(name, "frame")) {
+            m_frames.push_back({});
+            Frame& frame = m_frames.back();
+            if (version == 1) {
+                parsed = std::sscanf(line, "%*s %f", &frame.elapsed) == 1;
+            } else {
+                parsed = std::sscanf(line, "%*s %f %d", &frame.elapsed, &frame.steps) == 2 && frame.steps >= 0;
+            }
+        } else if (!m_frames.empty() && (!std::strcmp(name, "move") || !std::strcmp(name, "touch"))) {
+            event.type = name[0] == 'm' ? InputEvent::POINTER_MOVE : InputEvent::TOUCH;
+            parsed = std::sscanf(line, "%*s %lf %f %f", &event.time, &event.x, &event.y) == 3;
+            m_frames.back().events.push_back(event);
+        } else if (!m_frames.empty() && (!std::strcmp(name, "down") || !std::strcmp(name, "up")
+                                         || !std::strcmp(name, "wall-down") || !std::strcmp(name, "wall-up"))) {
+            bool wall = name[0] == 'w';
+            bool down = !std::strcmp(name + (wall ? 5 : 0), "down");
+            event.type = wall ? (down ? InputEvent::WALL_DOWN : InputEvent::WALL_UP)
+                              : (down ? InputEvent::POINTER_DOWN : InputEvent::POINTER_UP);
+            parsed = std::sscanf(line, "%*s %lf", &event.time) == 1;
+            m_frames.back().events.push_back(event);
+        } else {
+            parsed = false;
+        }
+        if (!parsed) {
+            std::cerr << path << ":" << number << ": cannot read '" << name << "'" << std::endl;
+            ok = false;
+        }
+    }
+    std::fclose(file);
+    if (ok && (m_settings.cellsX < 2 || m_settings.cellsY < 2 || m_settings.canvasWidth <= 0
+               || m_settings.canvasHeight <= 0)) {
+        std::cerr << path << " is not an input log" << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+bool InputLog::create(const std::string& path, const Settings& settings) {
+    close();
+    m_file = std::fopen(path.c_str(), "w");
+    if (!m_file) {
+        std::cerr << "Cannot create " << path << std::endl;
+        return false;
+    }
+    m_settings = settings;
+    std::fprintf(m_file, "fluid-input 2\n");
+    std::fprintf(m_file, "cells %u %u\n", settings.cellsX, settings.cellsY);
+    std::fprintf(m_file, "canvas %a %a\n", settings.canvasWidth, settings.canvasHeight);
+    std::fprintf(m_file, "step-size %a\n", settings.stepSize);
+    std::fprintf(m_file, "max-steps %u\n", settings.maxSteps);
+    std::fprintf(m_file, "max-cfl %a\n", settings.maxCfl);
+    std::fprintf(m_file, "max-substeps %u\n", settings.maxSubsteps);
+    std::fprintf(m_file, "sparse %u\n", settings.sparseTiles ? 1u : 0u);
+    std::fprintf(m_file, "params %a %a %a\n", settings.viscosity, settings.diffusionFactor, settings.dissolveFactor);
+    std::fprintf(m_file, "advection %u %u\n", (unsigned) settings.advection, (unsigned) settings.interpolation);
+    std::fprintf(m_file, "forces %a %a\n", settings.vorticity, settings.buoyancy);
+    for (size_t k = 0; k + 2 < settings.solidRuns.size(); k += 3) {
+        std::fprintf(m_file, "solid %u %u %u\n", settings.solidRuns[k], settings.solidRuns[k + 1],
+                     settings.solidRuns[k + 2]);
+    }
+    return true;
+}
+
+void InputLog::append(float elapsed, const std::vector<InputEvent>& events, uint32_t steps) {
+    if (!m_file) return;
+    std::fprintf(m_file, "frame %a %u\n", elapsed, steps);
+    for (const InputEvent& event : events) {
+        if (event.type == InputEvent::POINTER_MOVE || event.type == InputEvent::TOUCH) {
+            std::fprintf(m_file, "%s %a %a %a\n", eventName(event.type), event.time, event.x, event.y);
+        } else {
+            std::fprintf(m_file, "%s %a\n", eventName(event.type), event.time);
+        }
+    }
+}
+
+void InputLog::close() {
+    if (m_file) std::fclose(m_file);
+    m_file = nullptr;
+}
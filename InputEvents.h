@@ -0,0 +1,117 @@
+#ifndef INPUTEVENTS_H
+#define INPUTEVENTS_H
+
+#include "FixedTimestep.h"
+#include "FluidSolver.h"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Pointer input as timestamped events. The viewer queues them from its
+// window callbacks and turns them into forces between frames, so a run is
+// fully described by its frame times, the events of each frame and the steps
+// it ran; an InputLog of these replays to bit-identical fields, headless
+// included.
+struct InputEvent {
+    enum Type : uint32_t {
+        POINTER_MOVE, // mouse position
+        POINTER_DOWN, // left button
+        POINTER_UP,
+        TOUCH,        // one touch sample, pushes smoke where it is
+        WALL_DOWN,    // right button, draws solid cells under the pointer
+        WALL_UP
+    };
+
+    Type type;
+    double time;  // seconds since the start of the run
+    float x, y;   // canvas pixels, y pointing up
+};
+
+// Turns the events of a frame into solver forces: the mouse stirs the cell
+// under it each frame and adds smoke while the button is held, every touch
+// adds smoke and stirs along its movement. With the wall button held the
+// cells the pointer passed over since the last frame become solid instead.
+class InputForces {
+public:
+    InputForces(float canvasWidth, float canvasHeight): m_width(canvasWidth), m_height(canvasHeight) {}
+
+    void handle(const InputEvent& event);
+    // Applies the pointer state and the touches queued since the last call
+    void apply(FluidSolver& solver, float deltaTime);
+    // One frame of the interactive loop: forces only go in with a step, so
+    // the injected amount does not depend on the frame rate
+    void frame(FluidSolver& solver, const std::vector<InputEvent>& events, float deltaTime, uint32_t steps) {
+        for (const InputEvent& event : events) handle(event);
+        if (steps > 0) apply(solver, deltaTime);
+    }
+
+    float mouseSpeed = 60.0f, mouseDensity = 0.6f;
+    float touchSpeed = 20.0f, touchDensity = 2.0f;
+
+private:
+    bool inside(float x, float y) const { return x > 0 && x < m_width && y > 0 && y < m_height; }
+    // Solid cells from the last wall cell to (i, j), stepping to side
+    // neighbours only so the line has no diagonal gaps
+    void drawWall(FluidSolver& solver, uint32_t i, uint32_t j);
+
+    float m_width, m_height;
+    float m_x = 0.0f, m_y = 0.0f, m_prevX = 0.0f, m_prevY = 0.0f;
+    bool m_hasPointer = false, m_pressed = false, m_drawing = false, m_hasWallCell = false;
+    uint32_t m_wallI = 0, m_wallJ = 0;
+    float m_prevTouchX = 0.0f, m_prevTouchY = 0.0f;
+    std::vector<InputEvent> m_touches;
+};
+
+// What a run needs to be repeated: the solver settings it ran with, then
+// per batch of steps the time it covers, the events handled in it and the
+// number of steps. A viewer frame whose steps waited for a busy solver goes
+// into the next batch. Stored as text with floats in hexadecimal so they
+// read back exactly.
+class InputLog {
+public:
+    struct Settings {
+        uint32_t cellsX = 0, cellsY = 0;
+        float canvasWidth = 0.0f, canvasHeight = 0.0f;
+        float stepSize = 1.0f/60.0f;
+        uint32_t maxSteps = 4;
+        float maxCfl = 0.0f;
+        uint32_t maxSubsteps = 4;
+        bool sparseTiles = false;
+        float viscosity = 0.005f, diffusionFactor = 0.001f, dissolveFactor = 0.02f;
+        FluidSolver::AdvectionScheme advection = FluidSolver::SEMI_LAGRANGIAN;
+        FluidSolver::Interpolation interpolation = FluidSolver::BILINEAR;
+        float vorticity = 0.0f, buoyancy = 0.0f;
+        // Runs of solid cells as (j, first i, last i)
+        std::vector<uint32_t> solidRuns;
+    };
+    struct Frame {
+        float elapsed;
+        // Fixed steps run, -1 in version 1 logs: a FixedTimestep fed the
+        // elapsed times gives them, one batch per display frame
+        int32_t steps = -1;
+        std::vector<InputEvent> events;
+    };
+
+    static Settings settingsOf(const FluidSolver& solver, const FixedTimestep& timestep, float canvasWidth,
+                               float canvasHeight);
+    // Configures a solver and timestep the way the recorded run had them
+    static void apply(const Settings& settings, FluidSolver& solver, FixedTimestep& timestep);
+
+    bool load(const std::string& path);
+    const Settings& settings() const { return m_settings; }
+    const std::vector<Frame>& frames() const { return m_frames; }
+
+    // Writing goes straight to the file, a frame at a time
+    bool create(const std::string& path, const Settings& settings);
+    void append(float elapsed, const std::vector<InputEvent>& events, uint32_t steps);
+    void close();
+    ~InputLog() { close(); }
+
+private:
+    Settings m_settings;
+    std::vector<Frame> m_frames;
+    std::FILE* m_file = nullptr;
+};
+
+#endif //INPUTEVENTS_H
@@ -0,0 +1,88 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+// Heap-backed 2D field. Rows are padded so every row starts on a 64-byte
+// boundary, which keeps vector loads aligned and rows on separate cache lines.
+template<typename T>
+class Matrix{
+    static_assert(std::is_trivially_copyable<T>::value, "Matrix only holds plain values");
+
+public:
+    static constexpr size_t ALIGNMENT = 64;
+
+    static constexpr uint32_t paddedStride(uint32_t width) {
+        constexpr uint32_t perLine = ALIGNMENT/sizeof(T);
+        return (width + perLine - 1)/perLine*perLine;
+    }
+
+    Matrix() = default;
+    Matrix(uint32_t width, uint32_t height) { resize(width, height); }
+    Matrix(const Matrix& other) { *this = other; }
+    Matrix(Matrix&&) noexcept = default;
+    Matrix& operator=(Matrix&&) noexcept = default;
+    ~Matrix() = default;
+
+    Matrix& operator=(const Matrix& other) {
+        if (this == &other) return *this;
+        if (other.m_width != m_width || other.m_height != m_height) resize(other.m_width, other.m_height);
+        std::copy(other.data(), other.data() + size(), data());
+        return *this;
+    }
+
+    void resize(uint32_t width, uint32_t height) {
+        m_width = width;
+        m_height = height;
+        m_stride = paddedStride(width);
+        m_matrix.reset(size() ? static_cast<T*>(::operator new(size()*sizeof(T), std::align_val_t{ALIGNMENT})) : nullptr);
+        fill(T{});
+    }
+
+    void fill(T value) {
+        std::fill(data(), data() + size(), value);
+    }
+
+    void swap(Matrix& other){
+        m_matrix.swap(other.m_matrix);
+        std::swap(m_width, other.m_width);
+        std::swap(m_height, other.m_height);
+        std::swap(m_stride, other.m_stride);
+    }
+
+    T& operator() (uint32_t i, uint32_t j) {
+        return m_matrix[i + m_stride*j];
+    }
+    const T& operator()(uint32_t i, uint32_t j) const{
+        return m_matrix[i + m_stride*j];
+    }
+    // Indexes the padded storage directly, use stride() to walk rows
+    T& operator[] (uint32_t i) {
+        return m_matrix[i];
+    }
+    const T& operator[](uint32_t i) const{
+        return m_matrix[i];
+    }
+
+    T* data() { return m_matrix.get(); }
+    const T* data() const { return m_matrix.get(); }
+    uint32_t width() const { return m_width; }
+    uint32_t height() const { return m_height; }
+    uint32_t stride() const { return m_stride; }
+    size_t size() const { return (size_t) m_stride*m_height; }
+
+private:
+    struct AlignedDelete {
+        void operator()(T* p) const { ::operator delete(p, std::align_val_t{ALIGNMENT}); }
+    };
+
+    std::unique_ptr<T[], AlignedDelete> m_matrix;
+    uint32_t m_width = 0, m_height = 0, m_stride = 0;
+};
+
+#endif //MATRIX_H
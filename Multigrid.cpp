@@ -0,0 +1,176 @@
+#include "Multigrid.h"
+#include "FluidKernels.h"
+#include <cmath>
+
+static constexpr uint32_t MIN_COARSE_CELLS = 4;
+
+// Over the fluid cells only; the solid ones are zeroed, they have no equation
+static void removeMean(const GridShape& s, float* bp, const Obstacles* walls) {
+    FieldView<GridShape> b{bp, s};
+    double sum = 0.0;
+    uint32_t count = 0;
+    for (uint32_t j = 1; j <= s.ny; ++j) {
+        for (uint32_t i = 1; i <= s.nx; ++i) {
+            if (walls && walls->solid(i, j)) {
+                b(i, j) = 0.0f;
+                continue;
+            }
+            sum += b(i, j);
+            count++;
+        }
+    }
+    if (!count) return;
+    auto mean = (float) (sum/(double) count);
+    for (uint32_t j = 1; j <= s.ny; ++j) {
+        for (uint32_t i = 1; i <= s.nx; ++i) {
+            if (!walls || !walls->solid(i, j)) b(i, j) -= mean;
+        }
+    }
+}
+
+void Multigrid::resize(uint32_t nx, uint32_t ny) {
+    if (!m_levels.empty() && m_levels[0].shape.nx == nx && m_levels[0].shape.ny == ny) return;
+
+    m_levels.clear();
+    while (true) {
+        Level level{};
+        level.r.resize(nx + 2, ny + 2);
+        level.shape = GridShape{nx, ny, level.r.stride()};
+        if (!m_levels.empty()) {
+            level.pStorage.resize(nx + 2, ny + 2);
+            level.bStorage.resize(nx + 2, ny + 2);
+        }
+        m_levels.push_back(std::move(level));
+        if (std::min(nx, ny) < 2*MIN_COARSE_CELLS) break;
+        nx = (nx + 1)/2;
+        ny = (ny + 1)/2;
+    }
+    for (size_t l = 1; l < m_levels.size(); ++l) {
+        m_levels[l].p = m_levels[l].pStorage.data();
+        m_levels[l].b = m_levels[l].bStorage.data();
+    }
+}
+
+FluidKernels<GridShape> Multigrid::kernels(const Level& level) const {
+    return FluidKernels<GridShape>(level.shape, m_pool, m_order, m_simd, nullptr, {}, level.walls);
+}
+
+Multigrid::Result Multigrid::solve(const GridShape& shape, float* p, float* div, float tolerance, uint32_t maxCycles,
+                                   ThreadPool* pool, FluidSolver::RelaxOrder order, bool useSimd, const Obstacles* obstacles) {
+    resize(shape.nx, shape.ny);
+    m_pool = pool;
+    m_order = order;
+    m_simd = useSimd;
+    Level& fine = m_levels[0];
+    fine.shape = shape;
+    fine.p = p;
+    fine.b = div;
+    fine.walls = obstacles && !obstacles->empty() ? obstacles : nullptr;
+    for (size_t l = 1; l < m_levels.size(); ++l) {
+        Level& level = m_levels[l];
+        level.walls = nullptr;
+        if (!m_levels[l - 1].walls) continue;
+        level.coarseWalls.coarsen(*m_levels[l - 1].walls);
+        if (!level.coarseWalls.empty()) level.walls = &level.coarseWalls;
+    }
+
+    FluidKernels<GridShape> kernels = this->kernels(fine);
+    removeMean(shape, div, fine.walls);
+    kernels.setBounds(div);
+
+    float scale = 0.0f;
+    FieldView<GridShape> b{div, shape};
+    for (uint32_t j = 1; j <= shape.ny; ++j) {
+        for (uint32_t i = 1; i <= shape.nx; ++i) {
+            scale = std::max(scale, std::abs(b(i, j)));
+        }
+    }
+    if (scale == 0.0f) return {0, 0.0f};
+
+    Result result{0, kernels.pressureResidual(p, div, fine.r.data())/scale};
+    while (result.residual > tolerance && result.cycles < maxCycles) {
+        vcycle(0);
+        result.cycles++;
+        result.residual = kernels.pressureResidual(p, div, fine.r.data())/scale;
+    }
+    return result;
+}
+
+void Multigrid::vcycle(size_t l) {
+    Level& level = m_levels[l];
+    FluidKernels<GridShape> kernels = this->kernels(level);
+
+    if (l + 1 == m_levels.size()) {
+        kernels.relaxPressure(level.p, level.b, coarseSweeps);
+        return;
+    }
+
+    kernels.relaxPressure(level.p, level.b, preSmooth);
+    kernels.pressureResidual(level.p, level.b, level.r.data());
+
+    Level& coarse = m_levels[l + 1];
+    restrictResidual(level, coarse);
+    coarse.pStorage.fill(0.0f);
+    vcycle(l + 1);
+
+    prolongAndCorrect(coarse, level);
+    kernels.relaxPressure(level.p, level.b, postSmooth);
+}
+
+// The operator is unscaled by h^2, so the coarse right-hand side is the sum
+// (not the average) of the fine residuals it covers.
+void Multigrid::restrictResidual(const Level& fine, Level& coarse) {
+    const GridShape& fs = fine.shape;
+    const GridShape& cs = coarse.shape;
+    FieldView<GridShape, const float> r{fine.r.data(), fs};
+    FieldView<GridShape> b{coarse.b, cs};
+
+    kernels(coarse).forRows(1, cs.ny + 1, [&](uint32_t jBegin, uint32_t jEnd, uint32_t) {
+        for (uint32_t J = jBegin; J < jEnd; ++J) {
+            uint32_t j0 = 2*J - 1, j1 = std::min(2*J, fs.ny);
+            for (uint32_t I = 1; I <= cs.nx; ++I) {
+                uint32_t i0 = 2*I - 1, i1 = std::min(2*I, fs.nx);
+                float sum = r(i0, j0);
+                if (i1 != i0) sum += r(i1, j0);
+                if (j1 != j0) sum += r(i0, j1);
+                if (i1 != i0 && j1 != j0) sum += r(i1, j1);
+                b(I, J) = sum;
+            }
+        }
+    });
+    removeMean(cs, coarse.b, coarse.walls);
+}
+
+// Bilinear interpolation between cell centres: each fine cell takes 9/16 of
+// its parent, 3/16 of the two parents' neighbours towards it and 1/16 of the diagonal.
+// Solid cells take no correction, solid coarse neighbours are read as the parent.
+void Multigrid::prolongAndCorrect(const Level& coarse, Level& fine) {
+    const GridShape& fs = fine.shape;
+    const GridShape& cs = coarse.shape;
+    kernels(coarse).setBounds(coarse.p);
+    FieldView<GridShape, const float> e{coarse.p, cs};
+    FieldView<GridShape> p{fine.p, fs};
+    const Obstacles* walls = coarse.walls;
+
+    FluidKernels<GridShape> kernels = this->kernels(fine);
+    kernels.forRows(1, fs.ny + 1, [&](uint32_t jBegin, uint32_t jEnd, uint32_t) {
+        for (uint32_t j = jBegin; j < jEnd; ++j) {
+            uint32_t J = (j + 1)/2;
+            uint32_t Jn = (j & 1) ? J - 1 : J + 1;
+            for (uint32_t i = 1; i <= fs.nx; ++i) {
+                uint32_t I = (i + 1)/2;
+                uint32_t In = (i & 1) ? I - 1 : I + 1;
+                if (!walls) {
+                    p(i, j) += 0.5625f*e(I, J) + 0.1875f*(e(In, J) + e(I, Jn)) + 0.0625f*e(In, Jn);
+                    continue;
+                }
+                if (fine.walls->solid(i, j)) continue;
+                auto at = [&](uint32_t ci, uint32_t cj) {
+                    return ci >= 1 && ci <= cs.nx && cj >= 1 && cj <= cs.ny && walls->solid(ci, cj) ? e(I, J) : e(ci, cj);
+                };
+                p(i, j) += 0.5625f*e(I, J) + 0.1875f*(at(In, J) + at(I, Jn)) + 0.0625f*at(In, Jn);
+            }
+        }
+    });
+    kernels.setBounds(fine.p);
+}
@@ -0,0 +1,57 @@
+#ifndef MULTIGRID_H
+#define MULTIGRID_H
+
+#include "FluidSolver.h"
+#include "GridShape.h"
+#include "Matrix.h"
+#include "Obstacles.h"
+#include <vector>
+
+template<class Shape>
+class FluidKernels;
+
+// Geometric multigrid V-cycle for the pressure Poisson problem
+// 4p - sum(neighbours) = div with zero-gradient (Neumann) boundaries.
+// Gauss-Seidel is the smoother, coarse levels halve each dimension.
+// With obstacles every level smooths around its own mask, the coarse ones
+// coarsened from the fine mask, and solid cells take no correction.
+class Multigrid {
+public:
+    struct Result {
+        uint32_t cycles;
+        float residual; // max |div - A p| relative to max |div|
+    };
+
+    void resize(uint32_t nx, uint32_t ny);
+
+    // Solves in place starting from the given p. The mean of div is removed
+    // first, since only zero-mean right-hand sides have a Neumann solution.
+    Result solve(const GridShape& shape, float* p, float* div, float tolerance, uint32_t maxCycles,
+                 ThreadPool* pool = nullptr, FluidSolver::RelaxOrder order = FluidSolver::LEXICOGRAPHIC,
+                 bool useSimd = true, const Obstacles* obstacles = nullptr);
+
+    uint32_t preSmooth = 2, postSmooth = 2, coarseSweeps = 30;
+
+private:
+    struct Level {
+        GridShape shape;
+        float* p;
+        float* b;
+        Matrix<float> pStorage, bStorage, r;
+        Obstacles coarseWalls;
+        const Obstacles* walls; // null when the level has no solid cells
+    };
+
+    FluidKernels<GridShape> kernels(const Level& level) const;
+
+    void vcycle(size_t l);
+    void restrictResidual(const Level& fine, Level& coarse);
+    void prolongAndCorrect(const Level& coarse, Level& fine);
+
+    std::vector<Level> m_levels;
+    ThreadPool* m_pool = nullptr;
+    FluidSolver::RelaxOrder m_order = FluidSolver::LEXICOGRAPHIC;
+    bool m_simd = true;
+};
+
+#endif //MULTIGRID_H
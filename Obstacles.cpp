@@ -0,0 +1,131 @@
+#include "Obstacles.h"
+#include "Matrix.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+
+void Obstacles::resize(uint32_t nx, uint32_t ny) {
+    m_nx = nx;
+    m_ny = ny;
+    m_stride = Matrix<float>::paddedStride(nx + 2);
+    m_mask.assign((size_t) m_stride*(ny + 2), 0);
+    m_boundary.clear();
+    m_inner.clear();
+    m_edges.clear();
+    m_rowCells.clear();
+    m_rowStart.assign(ny + 3, 0);
+    m_solidCount = 0;
+    m_dirty = false;
+}
+
+void Obstacles::clear() {
+    std::fill(m_mask.begin(), m_mask.end(), 0);
+    m_dirty = true;
+}
+
+void Obstacles::set(uint32_t i, uint32_t j, bool solid) {
+    if (i < 1 || i > m_nx || j < 1 || j > m_ny) return;
+    uint8_t& cell = m_mask[(size_t) m_stride*j + i];
+    if (cell != (uint8_t) solid) m_dirty = true;
+    cell = solid;
+}
+
+void Obstacles::update() {
+    if (!m_dirty) return;
+    m_dirty = false;
+    m_version++;
+    m_boundary.clear();
+    m_inner.clear();
+    m_edges.clear();
+    m_rowCells.clear();
+    m_solidCount = 0;
+    // The outer ring is neither, it only mirrors the interior
+    auto fluid = [&](uint32_t ni, uint32_t nj) {
+        return ni >= 1 && ni <= m_nx && nj >= 1 && nj <= m_ny && !m_mask[ni + m_stride*nj];
+    };
+    auto solid = [&](uint32_t ni, uint32_t nj) { return m_mask[ni + m_stride*nj] != 0; };
+    for (uint32_t j = 1; j <= m_ny; ++j) {
+        m_rowStart[j] = (uint32_t) m_rowCells.size();
+        for (uint32_t i = 1; i <= m_nx; ++i) {
+            uint32_t index = i + m_stride*j;
+            if (m_mask[index]) {
+                m_solidCount++;
+                uint8_t code = (fluid(i - 1, j) ? LEFT : 0) | (fluid(i + 1, j) ? RIGHT : 0)
+                               | (fluid(i, j - 1) ? DOWN : 0) | (fluid(i, j + 1) ? UP : 0);
+                if (code) m_boundary.push_back({index, code});
+                else m_inner.push_back(index);
+                m_rowCells.push_back({index, SOLID});
+                continue;
+            }
+            uint8_t code = (solid(i - 1, j) ? LEFT : 0) | (solid(i + 1, j) ? RIGHT : 0)
+                           | (solid(i, j - 1) ? DOWN : 0) | (solid(i, j + 1) ? UP : 0);
+            bool diagonal = solid(i - 1, j - 1) || solid(i + 1, j - 1) || solid(i - 1, j + 1) || solid(i + 1, j + 1);
+            if (code || diagonal) m_edges.push_back({index, code});
+            if (code) m_rowCells.push_back({index, code});
+        }
+    }
+    m_rowStart[m_ny + 1] = (uint32_t) m_rowCells.size();
+}
+
+void Obstacles::coarsen(const Obstacles& fine) {
+    uint32_t nx = (fine.m_nx + 1)/2, ny = (fine.m_ny + 1)/2;
+    if (nx != m_nx || ny != m_ny) resize(nx, ny);
+    for (uint32_t j = 1; j <= ny; ++j) {
+        uint32_t j0 = 2*j - 1, j1 = std::min(2*j, fine.m_ny);
+        for (uint32_t i = 1; i <= nx; ++i) {
+            uint32_t i0 = 2*i - 1, i1 = std::min(2*i, fine.m_nx);
+            set(i, j, fine.solid(i0, j0) && fine.solid(i1, j0) && fine.solid(i0, j1) && fine.solid(i1, j1));
+        }
+    }
+    update();
+}
+
+bool Obstacles::loadPgm(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Could not open " << path << std::endl;
+        return false;
+    }
+    // Header fields are separated by whitespace, '#' comments run to the end of the line
+    auto next = [&file](uint32_t& value) {
+        while (file && (std::isspace(file.peek()) || file.peek() == '#')) {
+            if (file.get() == '#') file.ignore(1 << 16, '\n');
+        }
+        return (bool) (file >> value);
+    };
+    std::string magic;
+    uint32_t width = 0, height = 0, maxValue = 0;
+    file >> magic;
+    if ((magic != "P5" && magic != "P2") || !next(width) || !next(height) || !next(maxValue) || !width
+        || !height || !maxValue || maxValue > 65535) {
+        std::cerr << path << " is not a PGM image" << std::endl;
+        return false;
+    }
+    file.get();
+
+    std::vector<uint32_t> pixels((size_t) width*height);
+    for (uint32_t& pixel : pixels) {
+        if (magic == "P2") {
+            if (!next(pixel)) break;
+        } else if (maxValue < 256) {
+            pixel = (uint32_t) file.get();
+        } else {
+            uint32_t high = (uint32_t) file.get();
+            pixel = (high << 8) | (uint32_t) file.get();
+        }
+    }
+    if (!file) {
+        std::cerr << path << " is truncated" << std::endl;
+        return false;
+    }
+
+    for (uint32_t j = 1; j <= m_ny; ++j) {
+        uint32_t y = height - 1 - (uint32_t) ((uint64_t) (j - 1)*height/m_ny);
+        for (uint32_t i = 1; i <= m_nx; ++i) {
+            uint32_t x = (uint32_t) ((uint64_t) (i - 1)*width/m_nx);
+            set(i, j, 2*pixels[(size_t) y*width + x] < maxValue);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef OBSTACLES_H
+#define OBSTACLES_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Solid cells inside the grid, with compact lists built when the mask
+// changes so walls cost work in proportion to the cells next to them.
+//
+// The stencils treat a solid neighbour as a mirror of the fluid cell that
+// reads it: relaxation, divergence, gradient and advection substitute the
+// cell's own value (negated for the velocity component pointing into the
+// wall). A wall one cell thick therefore keeps the two sides apart. The
+// solid cells themselves are skipped by the sweeps; setBounds fills them
+// with the average of their fluid neighbours for display, and sets the
+// ones with no fluid neighbour to zero.
+class Obstacles {
+public:
+    // Which 4-neighbours of a boundary cell are fluid, or of an edge cell
+    // are solid. SOLID marks the solid cells in the row lists.
+    enum Direction : uint8_t {
+        LEFT = 1, RIGHT = 2, DOWN = 4, UP = 8, SOLID = 16
+    };
+
+    struct Cell {
+        uint32_t index; // i + stride*j in the solver fields
+        uint8_t code;   // Direction bits
+    };
+
+    void resize(uint32_t nx, uint32_t ny);
+    void clear();
+    // Interior cell, 1-based like the solver fields
+    void set(uint32_t i, uint32_t j, bool solid);
+    bool solid(uint32_t i, uint32_t j) const { return m_mask[(size_t) m_stride*j + i] != 0; }
+    // Reads a binary or ASCII PGM scaled to the grid; pixels darker than
+    // half grey are solid, the top row of the image is the top of the grid
+    bool loadPgm(const std::string& path);
+
+    // Rebuilds the cell lists when the mask changed since the last call
+    void update();
+    // This mask at half the resolution of fine, rounded up like the multigrid
+    // levels. A coarse cell is solid only when all the fine cells it covers
+    // are, so no passage closes and every fluid cell keeps a fluid parent.
+    void coarsen(const Obstacles& fine);
+    bool empty() const { return m_solidCount == 0; }
+    // Changes whenever update() rebuilds the lists
+    uint32_t version() const { return m_version; }
+    const std::vector<Cell>& boundary() const { return m_boundary; }
+    const std::vector<uint32_t>& inner() const { return m_inner; }
+    // Fluid cells with a solid cell among their 8 neighbours, the solid
+    // 4-neighbours in the code; these are the cells the stencils correct
+    const std::vector<Cell>& edges() const { return m_edges; }
+    // The cells of row j a sweep cannot treat as plain fluid: solid ones
+    // and fluid ones with a solid 4-neighbour, in column order
+    const Cell* rowBegin(uint32_t j) const { return m_rowCells.data() + m_rowStart[j]; }
+    const Cell* rowEnd(uint32_t j) const { return m_rowCells.data() + m_rowStart[j + 1]; }
+    uint32_t stride() const { return m_stride; }
+
+private:
+    uint32_t m_nx = 0, m_ny = 0, m_stride = 0;
+    std::vector<uint8_t> m_mask; // padded like the fields, the ring stays fluid
+    std::vector<Cell> m_boundary;
+    std::vector<uint32_t> m_inner;
+    std::vector<Cell> m_edges, m_rowCells;
+    std::vector<uint32_t> m_rowStart;
+    uint32_t m_solidCount = 0, m_version = 0;
+    bool m_dirty = false;
+};
+
+#endif //OBSTACLES_H
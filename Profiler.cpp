@@ -0,0 +1,166 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+Profiler* Profiler::s_active = nullptr;
+thread_local uint32_t ProfileScope::s_depth = 0;
+
+Profiler::Profiler(uint32_t frameCapacity): m_frames(std::max(1u, frameCapacity)), m_origin(now()) {}
+
+void Profiler::beginFrame() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Frame& frame = m_frames[m_frameCount % m_frames.size()];
+    frame.start = now();
+    frame.end = frame.start;
+    frame.eventCount = 0;
+    frame.counterCount = 0;
+    m_frameOpen = true;
+}
+
+void Profiler::endFrame() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_frameOpen) return;
+    m_frames[m_frameCount % m_frames.size()].end = now();
+    m_frameCount++;
+    m_frameOpen = false;
+}
+
+uint16_t Profiler::threadIndex() {
+    auto id = std::this_thread::get_id();
+    auto it = std::find(m_threads.begin(), m_threads.end(), id);
+    if (it != m_threads.end()) return (uint16_t) (it - m_threads.begin());
+    m_threads.push_back(id);
+    return (uint16_t) (m_threads.size() - 1);
+}
+
+void Profiler::record(const char* name, uint64_t start, uint64_t end, uint32_t depth) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_frameOpen) return;
+    Frame& frame = m_frames[m_frameCount % m_frames.size()];
+    if (frame.eventCount == MAX_EVENTS) return;
+    frame.events[frame.eventCount++] = {name, start, end, (uint16_t) depth, threadIndex()};
+}
+
+void Profiler::counter(const char* name, float value) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_frameOpen) return;
+    Frame& frame = m_frames[m_frameCount % m_frames.size()];
+    if (frame.counterCount == MAX_COUNTERS) return;
+    frame.counters[frame.counterCount++] = {name, now(), value};
+}
+
+// Completed frames, oldest first
+template<class F>
+void Profiler::forEachFrame(F&& f) const {
+    uint64_t count = std::min<uint64_t>(m_frameCount, m_frames.size());
+    for (uint64_t k = m_frameCount - count; k < m_frameCount; ++k) {
+        f(m_frames[k % m_frames.size()]);
+    }
+}
+
+Profiler::Stats Profiler::stats(const char* name) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<double> samples;
+    bool whole = std::strcmp(name, "frame") == 0;
+    forEachFrame([&](const Frame& frame) {
+        if (whole) {
+            samples.push_back((double) (frame.end - frame.start)*1e-6);
+            return;
+        }
+        double total = 0.0;
+        bool found = false;
+        for (uint32_t e = 0; e < frame.eventCount; ++e) {
+            if (std::strcmp(frame.events[e].name, name) != 0) continue;
+            total += (double) (frame.events[e].end - frame.events[e].start)*1e-6;
+            found = true;
+        }
+        if (found) samples.push_back(total);
+    });
+
+    Stats s{};
+    if (samples.empty()) return s;
+    std::sort(samples.begin(), samples.end());
+    s.frames = (uint32_t) samples.size();
+    s.minMs = samples.front();
+    s.maxMs = samples.back();
+    for (double v : samples) s.avgMs += v;
+    s.avgMs /= (double) samples.size();
+    s.p99Ms = samples[std::min(samples.size() - 1, (size_t) ((double) samples.size()*0.99))];
+    return s;
+}
+
+void Profiler::printStats(std::ostream& out) const {
+    std::vector<const char*> names{"frame"};
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        forEachFrame([&](const Frame& frame) {
+            for (uint32_t e = 0; e < frame.eventCount; ++e) {
+                const char* name = frame.events[e].name;
+                bool known = std::any_of(names.begin(), names.end(), [&](const char* n) { return std::strcmp(n, name) == 0; });
+                if (!known) names.push_back(name);
+            }
+        });
+    }
+
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-20s %8s %8s %8s %8s\n", "scope (ms)", "min", "avg", "p99", "max");
+    out << line;
+    for (const char* name : names) {
+        Stats s = stats(name);
+        std::snprintf(line, sizeof(line), "%-20s %8.3f %8.3f %8.3f %8.3f\n", name, s.minMs, s.avgMs, s.p99Ms, s.maxMs);
+        out << line;
+    }
+}
+
+std::string Profiler::summary(const std::vector<const char*>& names) const {
+    std::ostringstream out;
+    out.precision(2);
+    out << std::fixed;
+    for (size_t k = 0; k < names.size(); ++k) {
+        Stats s = stats(names[k]);
+        out << (k ? " | " : "") << names[k] << " " << s.avgMs << "/" << s.p99Ms << " ms";
+    }
+    return out.str();
+}
+
+bool Profiler::writeChromeTrace(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "Could not write " << path << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    char line[256];
+    bool first = true;
+    auto emit = [&](const char* text) {
+        file << (first ? "\n  " : ",\n  ") << text;
+        first = false;
+    };
+    auto micros = [this](uint64_t t) { return (double) (t - m_origin)*1e-3; };
+
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    forEachFrame([&](const Frame& frame) {
+        std::snprintf(line, sizeof(line), R"({"name": "frame", "ph": "X", "pid": 1, "tid": 0, "ts": %.3f, "dur": %.3f})",
+                      micros(frame.start), (double) (frame.end - frame.start)*1e-3);
+        emit(line);
+        for (uint32_t e = 0; e < frame.eventCount; ++e) {
+            const Event& ev = frame.events[e];
+            std::snprintf(line, sizeof(line), R"({"name": "%s", "ph": "X", "pid": 1, "tid": %u, "ts": %.3f, "dur": %.3f})",
+                          ev.name, (unsigned) ev.thread, micros(ev.start), (double) (ev.end - ev.start)*1e-3);
+            emit(line);
+        }
+        for (uint32_t c = 0; c < frame.counterCount; ++c) {
+            const Counter& counter = frame.counters[c];
+            std::snprintf(line, sizeof(line), R"({"name": "%s", "ph": "C", "pid": 1, "ts": %.3f, "args": {"value": %g}})",
+                          counter.name, micros(counter.time), (double) counter.value);
+            emit(line);
+        }
+    });
+    file << "\n]}\n";
+    return true;
+}
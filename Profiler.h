@@ -0,0 +1,123 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Per-frame timing of named scopes, kept in a ring buffer of the last
+// frames. Nothing is allocated while recording: frames hold fixed event
+// slots and scope names must be string literals (only the pointer is kept).
+//
+// PROFILE_SCOPE / PROFILE_COUNTER record into the active profiler and
+// compile to nothing unless FLUID_PROFILING is defined.
+class Profiler {
+public:
+    static constexpr uint32_t MAX_EVENTS = 48;
+    static constexpr uint32_t MAX_COUNTERS = 8;
+
+    struct Stats {
+        uint32_t frames = 0; // frames in the window that recorded the scope
+        double minMs = 0.0, avgMs = 0.0, p99Ms = 0.0, maxMs = 0.0;
+    };
+
+    explicit Profiler(uint32_t frameCapacity = 512);
+
+    // Scopes only record while a frame is open
+    void beginFrame();
+    void endFrame();
+
+    // Per-scope statistics over the frames in the ring, scopes with the same
+    // name in one frame are summed. "frame" gives the whole frame.
+    Stats stats(const char* name) const;
+    void printStats(std::ostream& out) const;
+    std::string summary(const std::vector<const char*>& names) const;
+
+    // Chrome trace-event JSON (chrome://tracing, Perfetto) of the buffered frames
+    bool writeChromeTrace(const std::string& path) const;
+
+    static void setActive(Profiler* profiler) { s_active = profiler; }
+    static Profiler* active() { return s_active; }
+    static uint64_t now() {
+        return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void record(const char* name, uint64_t start, uint64_t end, uint32_t depth);
+    void counter(const char* name, float value);
+    bool recording() const { return m_frameOpen; }
+
+private:
+    struct Event {
+        const char* name;
+        uint64_t start, end;
+        uint16_t depth, thread;
+    };
+    struct Counter {
+        const char* name;
+        uint64_t time;
+        float value;
+    };
+    struct Frame {
+        uint64_t start = 0, end = 0;
+        uint32_t eventCount = 0, counterCount = 0;
+        Event events[MAX_EVENTS];
+        Counter counters[MAX_COUNTERS];
+    };
+
+    uint16_t threadIndex();
+    template<class F> void forEachFrame(F&& f) const;
+
+    std::vector<Frame> m_frames;
+    uint64_t m_frameCount = 0;
+    std::atomic<bool> m_frameOpen{false};
+    uint64_t m_origin;
+    mutable std::mutex m_mutex;
+    std::vector<std::thread::id> m_threads;
+
+    static Profiler* s_active;
+};
+
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* name): m_name(name) {
+        Profiler* p = Profiler::active();
+        if (p && p->recording()) {
+            m_start = Profiler::now();
+            m_depth = s_depth++;
+            m_active = true;
+        }
+    }
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+    ~ProfileScope() {
+        if (!m_active) return;
+        s_depth--;
+        if (Profiler* p = Profiler::active()) p->record(m_name, m_start, Profiler::now(), m_depth);
+    }
+
+private:
+    const char* m_name;
+    uint64_t m_start = 0;
+    uint32_t m_depth = 0;
+    bool m_active = false;
+    static thread_local uint32_t s_depth;
+};
+
+#ifdef FLUID_PROFILING
+#define FLUID_PROFILE_CONCAT2(a, b) a##b
+#define FLUID_PROFILE_CONCAT(a, b) FLUID_PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(name) ProfileScope FLUID_PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_COUNTER(name, value) \
+    do { if (Profiler* profiler_ = Profiler::active()) profiler_->counter(name, (float) (value)); } while (0)
+#else
+#define PROFILE_SCOPE(name) do {} while (0)
+#define PROFILE_COUNTER(name, value) do {} while (0)
+#endif
+
+#endif //PROFILER_H
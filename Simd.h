@@ -0,0 +1,180 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstdint>
+
+// Thin wrappers over the vector instruction set picked at build time:
+// AVX2 (-mavx2), SSE2 (any x86-64), WASM SIMD128 (-msimd128), or none when
+// FLUID_NO_SIMD is defined or nothing matches. FLUID_HAS_SIMD tells the
+// kernels whether a vector path exists at all.
+//
+// The operations are plain IEEE lane-wise ops; written in the same order as
+// the scalar kernels they give bit-identical results as long as the compiler
+// does not contract them into FMAs, which is why AVX2 builds leave -mfma off.
+
+#if !defined(FLUID_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+
+#define FLUID_HAS_SIMD 1
+
+namespace simd {
+    constexpr uint32_t WIDTH = 8;
+    constexpr const char* NAME = "avx2";
+
+    using F = __m256;
+    using I = __m256i;
+    using Mask = __m256;
+
+    inline F load(const float* p) { return _mm256_loadu_ps(p); }
+    inline void store(float* p, F v) { _mm256_storeu_ps(p, v); }
+    inline F set1(float v) { return _mm256_set1_ps(v); }
+    inline F iota(float start) { return _mm256_add_ps(_mm256_set1_ps(start), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)); }
+    inline F add(F a, F b) { return _mm256_add_ps(a, b); }
+    inline F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+    inline F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+    inline F div(F a, F b) { return _mm256_div_ps(a, b); }
+    inline F min(F a, F b) { return _mm256_min_ps(a, b); }
+    inline F max(F a, F b) { return _mm256_max_ps(a, b); }
+    inline F sqrt(F a) { return _mm256_sqrt_ps(a); }
+    inline F abs(F a) { return _mm256_and_ps(a, _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff))); }
+    inline I truncate(F a) { return _mm256_cvttps_epi32(a); }
+    inline F toFloat(I a) { return _mm256_cvtepi32_ps(a); }
+    // i + stride*j per lane
+    inline I index(I i, I j, uint32_t stride) {
+        return _mm256_add_epi32(i, _mm256_mullo_epi32(j, _mm256_set1_epi32((int) stride)));
+    }
+    inline F gather(const float* base, I idx) { return _mm256_i32gather_ps(base, idx, 4); }
+    inline F gather(const float* base, I idx, uint32_t offset) { return _mm256_i32gather_ps(base + offset, idx, 4); }
+    // Lanes whose index has the given parity
+    inline Mask parityMask(uint32_t parity) {
+        return parity ? _mm256_castsi256_ps(_mm256_setr_epi32(0, -1, 0, -1, 0, -1, 0, -1))
+                      : _mm256_castsi256_ps(_mm256_setr_epi32(-1, 0, -1, 0, -1, 0, -1, 0));
+    }
+    // a where mask is set, b elsewhere
+    inline F select(Mask m, F a, F b) { return _mm256_blendv_ps(b, a, m); }
+}
+
+#elif !defined(FLUID_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#include <emmintrin.h>
+
+#define FLUID_HAS_SIMD 1
+
+namespace simd {
+    constexpr uint32_t WIDTH = 4;
+    constexpr const char* NAME = "sse2";
+
+    using F = __m128;
+    using I = __m128i;
+    using Mask = __m128;
+
+    inline F load(const float* p) { return _mm_loadu_ps(p); }
+    inline void store(float* p, F v) { _mm_storeu_ps(p, v); }
+    inline F set1(float v) { return _mm_set1_ps(v); }
+    inline F iota(float start) { return _mm_add_ps(_mm_set1_ps(start), _mm_setr_ps(0, 1, 2, 3)); }
+    inline F add(F a, F b) { return _mm_add_ps(a, b); }
+    inline F sub(F a, F b) { return _mm_sub_ps(a, b); }
+    inline F mul(F a, F b) { return _mm_mul_ps(a, b); }
+    inline F div(F a, F b) { return _mm_div_ps(a, b); }
+    inline F min(F a, F b) { return _mm_min_ps(a, b); }
+    inline F max(F a, F b) { return _mm_max_ps(a, b); }
+    inline F sqrt(F a) { return _mm_sqrt_ps(a); }
+    inline F abs(F a) { return _mm_and_ps(a, _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff))); }
+    inline I truncate(F a) { return _mm_cvttps_epi32(a); }
+    inline F toFloat(I a) { return _mm_cvtepi32_ps(a); }
+    // SSE2 has no 32-bit multiply, the index is built per lane
+    inline I index(I i, I j, uint32_t stride) {
+        alignas(16) int32_t is[4], js[4];
+        _mm_store_si128((__m128i*) is, i);
+        _mm_store_si128((__m128i*) js, j);
+        return _mm_setr_epi32(is[0] + (int32_t) stride*js[0], is[1] + (int32_t) stride*js[1],
+                              is[2] + (int32_t) stride*js[2], is[3] + (int32_t) stride*js[3]);
+    }
+    inline F gather(const float* base, I idx) {
+        alignas(16) int32_t k[4];
+        _mm_store_si128((__m128i*) k, idx);
+        return _mm_setr_ps(base[k[0]], base[k[1]], base[k[2]], base[k[3]]);
+    }
+    inline F gather(const float* base, I idx, uint32_t offset) { return gather(base + offset, idx); }
+    inline Mask parityMask(uint32_t parity) {
+        return parity ? _mm_castsi128_ps(_mm_setr_epi32(0, -1, 0, -1))
+                      : _mm_castsi128_ps(_mm_setr_epi32(-1, 0, -1, 0));
+    }
+    inline F select(Mask m, F a, F b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+}
+
+#elif !defined(FLUID_NO_SIMD) && defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+
+#define FLUID_HAS_SIMD 1
+
+namespace simd {
+    constexpr uint32_t WIDTH = 4;
+    constexpr const char* NAME = "wasm-simd128";
+
+    using F = v128_t;
+    using I = v128_t;
+    using Mask = v128_t;
+
+    inline F load(const float* p) { return wasm_v128_load(p); }
+    inline void store(float* p, F v) { wasm_v128_store(p, v); }
+    inline F set1(float v) { return wasm_f32x4_splat(v); }
+    inline F iota(float start) { return wasm_f32x4_add(wasm_f32x4_splat(start), wasm_f32x4_make(0, 1, 2, 3)); }
+    inline F add(F a, F b) { return wasm_f32x4_add(a, b); }
+    inline F sub(F a, F b) { return wasm_f32x4_sub(a, b); }
+    inline F mul(F a, F b) { return wasm_f32x4_mul(a, b); }
+    inline F div(F a, F b) { return wasm_f32x4_div(a, b); }
+    // pmin/pmax match the x86 minps/maxps semantics and lower to single instructions
+    inline F min(F a, F b) { return wasm_f32x4_pmin(a, b); }
+    inline F max(F a, F b) { return wasm_f32x4_pmax(a, b); }
+    inline F sqrt(F a) { return wasm_f32x4_sqrt(a); }
+    inline F abs(F a) { return wasm_f32x4_abs(a); }
+    inline I truncate(F a) { return wasm_i32x4_trunc_sat_f32x4(a); }
+    inline F toFloat(I a) { return wasm_f32x4_convert_i32x4(a); }
+    inline I index(I i, I j, uint32_t stride) {
+        return wasm_i32x4_add(i, wasm_i32x4_mul(j, wasm_i32x4_splat((int32_t) stride)));
+    }
+    inline F gather(const float* base, I idx) {
+        return wasm_f32x4_make(base[wasm_i32x4_extract_lane(idx, 0)], base[wasm_i32x4_extract_lane(idx, 1)],
+                               base[wasm_i32x4_extract_lane(idx, 2)], base[wasm_i32x4_extract_lane(idx, 3)]);
+    }
+    inline F gather(const float* base, I idx, uint32_t offset) { return gather(base + offset, idx); }
+    inline Mask parityMask(uint32_t parity) {
+        return parity ? wasm_i32x4_make(0, -1, 0, -1) : wasm_i32x4_make(-1, 0, -1, 0);
+    }
+    inline F select(Mask m, F a, F b) { return wasm_v128_bitselect(a, b, m); }
+}
+
+#else
+
+#define FLUID_HAS_SIMD 0
+
+namespace simd {
+    constexpr uint32_t WIDTH = 1;
+    constexpr const char* NAME = "scalar";
+}
+
+#endif
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+namespace simd {
+    // Keeps denormals out of the arithmetic on the calling thread while alive:
+    // results flush to zero (FTZ) and denormal inputs read as zero (DAZ).
+    // Fields decaying towards zero otherwise hit microcode assists that slow
+    // the kernels down several times. No-op where there is no such control.
+    struct DenormalScope {
+#if defined(__SSE__) || defined(_M_X64)
+        unsigned int previous = _mm_getcsr();
+        DenormalScope() { _mm_setcsr(previous | 0x8040); }
+        ~DenormalScope() { _mm_setcsr(previous); }
+#else
+        DenormalScope() = default;
+#endif
+        DenormalScope(const DenormalScope &) = delete;
+        DenormalScope &operator=(const DenormalScope &) = delete;
+    };
+}
+
+#endif //SIMD_H
@@ -0,0 +1,440 @@
+#include "Snapshot.h"
+#include "Half.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FLUID_HAS_MMAP 1
+#else
+#include <fstream>
+#define FLUID_HAS_MMAP 0
+#endif
+
+using namespace snapshot;
+
+static constexpr size_t PAYLOAD_ALIGNMENT = 16;
+
+static size_t padded(size_t bytes) {
+    return (bytes + PAYLOAD_ALIGNMENT - 1)/PAYLOAD_ALIGNMENT*PAYLOAD_ALIGNMENT;
+}
+
+static uint32_t wordBytes(uint32_t encoding) {
+    return encoding == FLOAT16 ? 2 : 4;
+}
+
+static const FluidSolver::Field& solverField(const FluidSolver& solver, Field field) {
+    switch (field) {
+        case VEL_X: return solver.curState.velX;
+        case VEL_Y: return solver.curState.velY;
+        case PREV_DENSITY: return solver.prevState.density;
+        case PREV_VEL_X: return solver.prevState.velX;
+        case PREV_VEL_Y: return solver.prevState.velY;
+        default: return solver.curState.density;
+    }
+}
+
+static void putVarint(std::vector<uint8_t>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back((uint8_t) (value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t) value);
+}
+
+static bool getVarint(const uint8_t*& in, const uint8_t* end, uint32_t& value) {
+    value = 0;
+    for (uint32_t shift = 0; in < end && shift < 35; shift += 7) {
+        uint8_t byte = *in++;
+        value |= (uint32_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// Runs of zero words as counts, the other words as they are:
+// (zeros, literals, literal words)*
+static void encodeRuns(const std::vector<uint32_t>& words, uint32_t bytesPerWord, std::vector<uint8_t>& out) {
+    out.clear();
+    size_t n = words.size(), k = 0;
+    while (k < n) {
+        size_t zeros = k;
+        while (zeros < n && words[zeros] == 0) zeros++;
+        size_t literals = zeros;
+        // A lone zero between literals is cheaper kept as a literal
+        while (literals < n && (words[literals] != 0 || (literals + 1 < n && words[literals + 1] != 0))) literals++;
+        putVarint(out, (uint32_t) (zeros - k));
+        putVarint(out, (uint32_t) (literals - zeros));
+        for (size_t w = zeros; w < literals; ++w) {
+            for (uint32_t b = 0; b < bytesPerWord; ++b) out.push_back((uint8_t) (words[w] >> (8*b)));
+        }
+        k = literals;
+    }
+}
+
+static bool decodeRuns(const uint8_t* in, uint32_t bytes, uint32_t bytesPerWord, std::vector<uint32_t>& words) {
+    const uint8_t* end = in + bytes;
+    size_t k = 0, n = words.size();
+    while (k < n) {
+        uint32_t zeros, literals;
+        if (!getVarint(in, end, zeros) || !getVarint(in, end, literals)) return false;
+        if (k + zeros + literals > n || (size_t) (end - in) < (size_t) literals*bytesPerWord) return false;
+        std::fill_n(words.begin() + (ptrdiff_t) k, zeros, 0u);
+        k += zeros;
+        for (uint32_t w = 0; w < literals; ++w, ++k) {
+            uint32_t word = 0;
+            for (uint32_t b = 0; b < bytesPerWord; ++b) word |= (uint32_t) *in++ << (8*b);
+            words[k] = word;
+        }
+    }
+    return true;
+}
+
+FileHeader snapshot::headerFor(const FluidSolver& solver, uint32_t fields, float dt) {
+    FileHeader header;
+    header.width = solver.numTilesX();
+    header.height = solver.numTilesY();
+    header.fields = fields;
+    header.dt = dt;
+    header.viscosity = solver.viscosity;
+    header.diffusion = solver.diffusionFactor;
+    header.dissolve = solver.dissolveFactor;
+    return header;
+}
+
+bool SnapshotWriter::open(const std::string& path, const FileHeader& header) {
+    close();
+    m_file = std::fopen(path.c_str(), "wb");
+    if (!m_file) {
+        std::cerr << "Could not write " << path << std::endl;
+        return false;
+    }
+    m_header = header;
+    m_header.keyframeInterval = std::max(1u, m_header.keyframeInterval);
+    std::fwrite(&m_header, sizeof(m_header), 1, m_file);
+    m_bytes = sizeof(m_header);
+    m_written = m_dropped = 0;
+    m_nextIndex = 0;
+    m_stop = false;
+    for (auto& previous : m_previous) previous.clear();
+
+    m_free.assign(std::max(1u, m_queueDepth), Capture{});
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+    m_thread = std::thread(&SnapshotWriter::loop, this);
+#endif
+    return true;
+}
+
+void SnapshotWriter::close() {
+    if (!m_file) return;
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        m_thread.join();
+    }
+    m_header.frames = m_nextIndex;
+    std::fseek(m_file, 0, SEEK_SET);
+    std::fwrite(&m_header, sizeof(m_header), 1, m_file);
+    std::fclose(m_file);
+    m_file = nullptr;
+    m_queue.clear();
+    m_free.clear();
+}
+
+bool SnapshotWriter::push(const FluidSolver& solver) {
+    if (!m_file) return false;
+    if (solver.numTilesX() != m_header.width || solver.numTilesY() != m_header.height) return false;
+
+    Capture capture;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_blocking) m_freed.wait(lock, [this] { return !m_free.empty(); });
+        if (m_free.empty()) {
+            // The frame keeps its index, so readers see the gap
+            m_nextIndex++;
+            m_dropped++;
+            return false;
+        }
+        capture = std::move(m_free.back());
+        m_free.pop_back();
+    }
+
+    capture.index = m_nextIndex++;
+    for (uint32_t f = 0; f < FIELD_COUNT; ++f) {
+        if (!(m_header.fields & (1u << f))) continue;
+        const FluidSolver::Field& field = solverField(solver, (Field) f);
+        auto& out = capture.fields[f];
+        out.resize((size_t) field.width()*field.height());
+        for (uint32_t j = 0; j < field.height(); ++j) {
+            std::copy(&field(0, j), &field(0, j) + field.width(), out.begin() + (ptrdiff_t) field.width()*j);
+        }
+    }
+
+    if (!m_thread.joinable()) {
+        // No threads: encode and write right here
+        write(capture);
+        m_free.push_back(std::move(capture));
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(std::move(capture));
+    }
+    m_wake.notify_one();
+    return true;
+}
+
+void SnapshotWriter::loop() {
+    while (true) {
+        Capture capture;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+            // Queued frames are written before stopping
+            if (m_queue.empty()) return;
+            capture = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        write(capture);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_free.push_back(std::move(capture));
+        }
+        m_freed.notify_one();
+    }
+}
+
+void SnapshotWriter::write(Capture& capture) {
+    FrameHeader frame;
+    frame.index = capture.index;
+    // A run of delta frames starts every keyframeInterval indices, or at the
+    // first frame written when the one due was dropped
+    uint32_t interval = m_header.keyframeInterval;
+    frame.keyframe = m_header.compression == NONE || m_written == 0
+                     || capture.index/interval != m_lastIndex/interval;
+    m_lastIndex = capture.index;
+
+    uint32_t bytesPerWord = wordBytes(m_header.encoding);
+    std::vector<uint8_t>& record = m_record;
+    record.assign(sizeof(FrameHeader), 0);
+    for (uint32_t f = 0; f < FIELD_COUNT; ++f) {
+        if (!(m_header.fields & (1u << f))) continue;
+        const auto& values = capture.fields[f];
+        m_words.resize(values.size());
+        for (size_t k = 0; k < values.size(); ++k) {
+            if (m_header.encoding == FLOAT16) {
+                m_words[k] = half::fromFloat(values[k]);
+            } else {
+                std::memcpy(&m_words[k], &values[k], sizeof(float));
+            }
+        }
+
+        ChunkHeader chunk;
+        chunk.field = f;
+        const uint8_t* payload;
+        if (m_header.compression == DELTA) {
+            // Keyframes are stored whole, the frames after them as the XOR with their predecessor
+            auto& previous = m_previous[f];
+            previous.resize(m_words.size(), 0);
+            for (size_t k = 0; k < m_words.size(); ++k) {
+                uint32_t word = m_words[k];
+                if (!frame.keyframe) m_words[k] ^= previous[k];
+                previous[k] = word;
+            }
+            encodeRuns(m_words, bytesPerWord, m_encoded);
+            chunk.compressed = 1;
+            chunk.bytes = (uint32_t) m_encoded.size();
+            payload = m_encoded.data();
+        } else {
+            m_encoded.resize(m_words.size()*bytesPerWord);
+            for (size_t k = 0; k < m_words.size(); ++k) std::memcpy(&m_encoded[k*bytesPerWord], &m_words[k], bytesPerWord);
+            chunk.bytes = (uint32_t) m_encoded.size();
+            payload = m_encoded.data();
+        }
+
+        size_t at = record.size();
+        record.resize(at + sizeof(ChunkHeader) + padded(chunk.bytes), 0);
+        std::memcpy(&record[at], &chunk, sizeof(chunk));
+        std::memcpy(&record[at + sizeof(ChunkHeader)], payload, chunk.bytes);
+        frame.chunkCount++;
+    }
+
+    frame.bytes = record.size();
+    std::memcpy(record.data(), &frame, sizeof(frame));
+    std::fwrite(record.data(), 1, record.size(), m_file);
+    m_bytes += record.size();
+    m_written++;
+}
+
+bool SnapshotReader::open(const std::string& path) {
+    close();
+#if FLUID_HAS_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info{};
+    if (fd >= 0 && fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* data = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            m_data = (const uint8_t*) data;
+            m_size = (size_t) info.st_size;
+            m_mapped = true;
+        }
+    }
+    if (fd >= 0) ::close(fd);
+#else
+    std::ifstream file(path, std::ios::binary);
+    m_contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    m_data = m_contents.data();
+    m_size = m_contents.size();
+#endif
+    if (!m_data || m_size < sizeof(FileHeader)) {
+        std::cerr << "Could not read " << path << std::endl;
+        close();
+        return false;
+    }
+
+    std::memcpy(&m_header, m_data, sizeof(m_header));
+    if (std::memcmp(m_header.magic, "FSNP", 4) != 0 || m_header.version != 1 || m_header.encoding > FLOAT16
+        || m_header.compression > DELTA) {
+        std::cerr << path << " is not a snapshot recording" << std::endl;
+        close();
+        return false;
+    }
+
+    // Index the frames; a record cut short by an interrupted writer ends the recording
+    size_t offset = sizeof(FileHeader);
+    size_t fieldBytes = (size_t) m_header.width*m_header.height*wordBytes(m_header.encoding);
+    while (offset + sizeof(FrameHeader) <= m_size) {
+        FrameHeader frameHeader;
+        std::memcpy(&frameHeader, m_data + offset, sizeof(frameHeader));
+        if (std::memcmp(frameHeader.magic, "FRME", 4) != 0 || frameHeader.bytes > m_size - offset) break;
+
+        Frame frame{};
+        frame.index = frameHeader.index;
+        frame.keyframe = frameHeader.keyframe != 0;
+        size_t at = offset + sizeof(FrameHeader);
+        bool valid = true;
+        for (uint32_t c = 0; c < frameHeader.chunkCount && valid; ++c) {
+            ChunkHeader chunk;
+            if (at + sizeof(chunk) > offset + frameHeader.bytes) {
+                valid = false;
+                break;
+            }
+            std::memcpy(&chunk, m_data + at, sizeof(chunk));
+            at += sizeof(chunk);
+            valid = chunk.field < FIELD_COUNT && at + chunk.bytes <= offset + frameHeader.bytes
+                    && (chunk.compressed || chunk.bytes == fieldBytes);
+            if (valid) frame.chunks[chunk.field] = {m_data + at, chunk.bytes, chunk.compressed != 0};
+            at += padded(chunk.bytes);
+        }
+        if (!valid) break;
+        m_frames.push_back(frame);
+        offset += frameHeader.bytes;
+    }
+
+    for (uint32_t f = 0; f < FIELD_COUNT; ++f) m_decodedFrame[f] = -1;
+    return true;
+}
+
+void SnapshotReader::close() {
+#if FLUID_HAS_MMAP
+    if (m_mapped) munmap((void*) m_data, m_size);
+#endif
+    m_mapped = false;
+    m_data = nullptr;
+    m_size = 0;
+    m_contents.clear();
+    m_frames.clear();
+}
+
+uint32_t SnapshotReader::missingFrames() const {
+    // Without the count from close(), only gaps before the last frame show
+    uint32_t pushed = m_frames.empty() ? 0 : m_frames.back().index + 1;
+    return std::max(pushed, m_header.frames) - frameCount();
+}
+
+const float* SnapshotReader::field(uint32_t frame, Field field) {
+    if (frame >= m_frames.size() || field >= FIELD_COUNT) return nullptr;
+    const Chunk& chunk = m_frames[frame].chunks[field];
+    if (!chunk.payload) return nullptr;
+    // Raw float32 straight from the mapping
+    if (!chunk.compressed && m_header.encoding == FLOAT32) return (const float*) chunk.payload;
+    return decode(frame, field) ? m_decoded[field].data() : nullptr;
+}
+
+bool SnapshotReader::decode(uint32_t frame, Field field) {
+    if (m_decodedFrame[field] == frame) return true;
+
+    size_t n = (size_t) m_header.width*m_header.height;
+    uint32_t bytesPerWord = wordBytes(m_header.encoding);
+    auto& words = m_words[field];
+    words.resize(n);
+
+    const Chunk& target = m_frames[frame].chunks[field];
+    if (!target.compressed) {
+        for (size_t k = 0; k < n; ++k) {
+            uint32_t word = 0;
+            std::memcpy(&word, target.payload + k*bytesPerWord, bytesPerWord);
+            words[k] = word;
+        }
+    } else {
+        // Delta frames need their predecessor: continue from the last decoded
+        // frame when it is on the way, from the keyframe otherwise
+        uint32_t first = frame;
+        while (first > 0 && !m_frames[first].keyframe && (int64_t) first - 1 != m_decodedFrame[field]) first--;
+        bool continuing = !m_frames[first].keyframe;
+
+        std::vector<uint32_t> delta(n);
+        for (uint32_t f = first; f <= frame; ++f) {
+            const Chunk& chunk = m_frames[f].chunks[field];
+            if (!chunk.payload || !decodeRuns(chunk.payload, chunk.bytes, bytesPerWord, delta)) {
+                m_decodedFrame[field] = -1;
+                return false;
+            }
+            if (m_frames[f].keyframe && !(f == first && continuing)) {
+                words.swap(delta);
+            } else {
+                for (size_t k = 0; k < n; ++k) words[k] ^= delta[k];
+            }
+        }
+    }
+
+    auto& values = m_decoded[field];
+    values.resize(n);
+    for (size_t k = 0; k < n; ++k) {
+        if (m_header.encoding == FLOAT16) {
+            values[k] = half::toFloat((uint16_t) words[k]);
+        } else {
+            std::memcpy(&values[k], &words[k], sizeof(float));
+        }
+    }
+    m_decodedFrame[field] = frame;
+    return true;
+}
+
+bool SnapshotReader::load(uint32_t frame, FluidSolver& solver) {
+    if (frame >= m_frames.size() || solver.numTilesX() != m_header.width || solver.numTilesY() != m_header.height) {
+        return false;
+    }
+    FluidSolver::Field* targets[FIELD_COUNT] = {&solver.curState.density, &solver.curState.velX, &solver.curState.velY,
+                                                &solver.prevState.density, &solver.prevState.velX, &solver.prevState.velY};
+    for (uint32_t f = 0; f < FIELD_COUNT; ++f) {
+        if (!hasField((Field) f)) continue;
+        const float* values = field(frame, (Field) f);
+        if (!values) return false;
+        for (uint32_t j = 0; j < m_header.height; ++j) {
+            std::copy(values + (size_t) m_header.width*j, values + (size_t) m_header.width*(j + 1), &(*targets[f])(0, j));
+        }
+    }
+    // A solver keeping its density in fixed point takes it from the loaded floats
+    solver.packDensity();
+    // Whatever was loaded can be anywhere on the grid
+    solver.markAllActive();
+    return true;
+}
@@ -0,0 +1,185 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "FluidSolver.h"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Recordings of solver fields: a 64 byte file header with the grid size and
+// solver parameters, then one record per frame holding a chunk per field.
+// Fields cover the whole grid, boundary cells included, row after row.
+//
+//   FileHeader | FrameHeader ChunkHeader payload ... | FrameHeader ...
+//
+// Payloads are float32 or float16 and start 16-byte aligned, so raw float32
+// chunks are usable in place from a mapped file. Delta compression XORs each
+// word with the same word of the previous frame (of the last keyframe's run)
+// and stores runs of zero words as counts, which suits smoke that covers a
+// small part of the grid and changes slowly. All values are little endian.
+namespace snapshot {
+    enum Field : uint32_t {
+        DENSITY, VEL_X, VEL_Y,               // curState
+        PREV_DENSITY, PREV_VEL_X, PREV_VEL_Y, // prevState, for resuming bit for bit
+        FIELD_COUNT
+    };
+
+    // Field sets
+    constexpr uint32_t DENSITY_ONLY = 1u << DENSITY;
+    constexpr uint32_t STATE = DENSITY_ONLY | 1u << VEL_X | 1u << VEL_Y;
+    constexpr uint32_t CHECKPOINT = STATE | 1u << PREV_DENSITY | 1u << PREV_VEL_X | 1u << PREV_VEL_Y;
+
+    enum Encoding : uint32_t { FLOAT32, FLOAT16 };
+    enum Compression : uint32_t { NONE, DELTA };
+
+    struct FileHeader {
+        char magic[4] = {'F', 'S', 'N', 'P'};
+        uint32_t version = 1;
+        uint32_t width = 0, height = 0;
+        uint32_t fields = DENSITY_ONLY;
+        uint32_t encoding = FLOAT32;
+        uint32_t compression = NONE;
+        // Delta frames restart from a full frame this often
+        uint32_t keyframeInterval = 30;
+        float dt = 0.0f, viscosity = 0.0f, diffusion = 0.0f, dissolve = 0.0f;
+        // Frames pushed to the writer, dropped ones included; set by close(),
+        // 0 in a recording that was cut short
+        uint32_t frames = 0;
+        uint32_t reserved[3]{};
+    };
+
+    struct FrameHeader {
+        char magic[4] = {'F', 'R', 'M', 'E'};
+        uint32_t index = 0; // in push() order, so dropped frames leave gaps
+        uint32_t keyframe = 1;
+        uint32_t chunkCount = 0;
+        uint64_t bytes = 0; // whole record, this header included
+        uint64_t reserved = 0;
+    };
+
+    struct ChunkHeader {
+        uint32_t field = 0;
+        uint32_t compressed = 0;
+        uint32_t bytes = 0; // payload, before padding
+        uint32_t reserved = 0;
+    };
+
+    static_assert(sizeof(FileHeader) == 64 && sizeof(FrameHeader) == 32 && sizeof(ChunkHeader) == 16,
+                  "snapshot headers are written as they are");
+
+    FileHeader headerFor(const FluidSolver& solver, uint32_t fields, float dt);
+}
+
+// Streams frames to a file from a background thread. push() only copies the
+// fields into a free buffer; when the writer falls behind by more than
+// queueDepth frames, frames are dropped rather than stalling the caller, or
+// with blocking set push() waits for a buffer and no frame is lost.
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(uint32_t queueDepth = 4, bool blocking = false)
+        : m_queueDepth(queueDepth), m_blocking(blocking) {}
+    SnapshotWriter(const SnapshotWriter &) = delete;
+    SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+    ~SnapshotWriter() { close(); }
+
+    bool open(const std::string& path, const snapshot::FileHeader& header);
+    // Waits for the queued frames and closes the file
+    void close();
+    bool push(const FluidSolver& solver);
+
+    uint64_t framesWritten() const { return m_written; }
+    uint64_t framesDropped() const { return m_dropped; }
+    uint64_t bytesWritten() const { return m_bytes; }
+
+private:
+    struct Capture {
+        uint32_t index;
+        std::vector<float> fields[snapshot::FIELD_COUNT];
+    };
+
+    void loop();
+    void write(Capture& capture);
+
+    snapshot::FileHeader m_header;
+    std::FILE* m_file = nullptr;
+    uint32_t m_queueDepth;
+    bool m_blocking;
+    uint32_t m_nextIndex = 0;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake, m_freed;
+    std::deque<Capture> m_queue;
+    std::vector<Capture> m_free;
+    bool m_stop = false, m_writing = false;
+    uint64_t m_written = 0, m_dropped = 0, m_bytes = 0;
+
+    // Writer thread state: index of the last frame written and its words per
+    // field for delta compression, and scratch for encoding
+    uint32_t m_lastIndex = 0;
+    std::vector<uint32_t> m_previous[snapshot::FIELD_COUNT];
+    std::vector<uint32_t> m_words;
+    std::vector<uint8_t> m_encoded, m_record;
+};
+
+// Reads a recording through a read-only memory mapping (a plain read into
+// memory where there is no mmap). Raw float32 chunks are handed out in place;
+// other encodings are decoded into a per-field buffer, delta frames by
+// running forward from their keyframe, which is cheap for sequential reads.
+class SnapshotReader {
+public:
+    SnapshotReader() = default;
+    SnapshotReader(const SnapshotReader &) = delete;
+    SnapshotReader &operator=(const SnapshotReader &) = delete;
+    ~SnapshotReader() { close(); }
+
+    bool open(const std::string& path);
+    void close();
+
+    const snapshot::FileHeader& header() const { return m_header; }
+    uint32_t frameCount() const { return (uint32_t) m_frames.size(); }
+    // The writer's index of a stored frame
+    uint32_t frameIndex(uint32_t frame) const { return m_frames[frame].index; }
+    // Frames the writer dropped or never finished, anywhere in the recording
+    uint32_t missingFrames() const;
+    bool hasField(snapshot::Field field) const { return m_header.fields & (1u << field); }
+
+    // width*height values of a field, rows header().width apart; nullptr when
+    // the frame or field is missing. Valid until the next call for that field.
+    const float* field(uint32_t frame, snapshot::Field field);
+    // Copies a frame into the solver, whose grid must match; prevState too
+    // when the recording has it
+    bool load(uint32_t frame, FluidSolver& solver);
+
+private:
+    struct Chunk {
+        const uint8_t* payload = nullptr;
+        uint32_t bytes = 0;
+        bool compressed = false;
+    };
+    struct Frame {
+        uint32_t index;
+        bool keyframe;
+        Chunk chunks[snapshot::FIELD_COUNT];
+    };
+
+    bool decode(uint32_t frame, snapshot::Field field);
+
+    snapshot::FileHeader m_header;
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_mapped = false;
+    std::vector<uint8_t> m_contents; // without mmap
+    std::vector<Frame> m_frames;
+
+    // Per field: decoded floats, the words they came from and their frame
+    std::vector<float> m_decoded[snapshot::FIELD_COUNT];
+    std::vector<uint32_t> m_words[snapshot::FIELD_COUNT];
+    int64_t m_decodedFrame[snapshot::FIELD_COUNT]{-1, -1, -1, -1, -1, -1};
+};
+
+#endif //SNAPSHOT_H
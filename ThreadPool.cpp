@@ -0,0 +1,72 @@
+#include "ThreadPool.h"
+#include "Simd.h"
+
+ThreadPool::ThreadPool(uint32_t threadCount) {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    // No threads without the pthread build, everything runs on the caller
+    threadCount = 1;
+#endif
+    for (uint32_t band = 1; band < threadCount; ++band) {
+        m_workers.emplace_back(&ThreadPool::workerLoop, this, band);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& worker : m_workers) worker.join();
+}
+
+void ThreadPool::parallelFor(uint32_t begin, uint32_t end, const Task& task) {
+    uint32_t bands = size();
+    if (bands == 1) {
+        task(begin, end, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_begin = begin;
+        m_end = end;
+        m_pending = bands - 1;
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    task(bandBegin(begin, end, 0, bands), bandBegin(begin, end, 1, bands), 0);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_pending == 0; });
+    m_task = nullptr;
+}
+
+void ThreadPool::workerLoop(uint32_t band) {
+    // Workers only ever run solver kernels, so denormals stay off for good
+    simd::DenormalScope denormals;
+    uint64_t seen = 0;
+    while (true) {
+        const Task* task;
+        uint32_t begin, end;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+            if (m_stop) return;
+            seen = m_generation;
+            task = m_task;
+            begin = m_begin;
+            end = m_end;
+        }
+
+        uint32_t bands = size();
+        (*task)(bandBegin(begin, end, band, bands), bandBegin(begin, end, band + 1, bands), band);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_pending == 0) m_done.notify_one();
+        }
+    }
+}
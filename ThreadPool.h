@@ -0,0 +1,44 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent workers for row-banded kernels. The caller takes part in every
+// parallelFor, and a range is always cut into the same contiguous bands for
+// a given thread count, so per-band reductions combine in a fixed order.
+class ThreadPool {
+public:
+    using Task = std::function<void(uint32_t begin, uint32_t end, uint32_t band)>;
+
+    explicit ThreadPool(uint32_t threadCount);
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+    ~ThreadPool();
+
+    uint32_t size() const { return (uint32_t) m_workers.size() + 1; }
+
+    // Runs task on size() bands of [begin, end) and returns when all are done
+    void parallelFor(uint32_t begin, uint32_t end, const Task& task);
+
+    static uint32_t bandBegin(uint32_t begin, uint32_t end, uint32_t band, uint32_t bands) {
+        return begin + (uint32_t) ((uint64_t) (end - begin)*band/bands);
+    }
+
+private:
+    void workerLoop(uint32_t band);
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake, m_done;
+    const Task* m_task = nullptr;
+    uint32_t m_begin = 0, m_end = 0, m_pending = 0;
+    uint64_t m_generation = 0;
+    bool m_stop = false;
+};
+
+#endif //THREADPOOL_H
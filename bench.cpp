@@ -0,0 +1,277 @@
+#include "FluidSolver.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Times the solver stages over a sweep of grid sizes and thread counts.
+//
+// Every sample is one call of the stage; samples are taken until both a
+// minimum count and a minimum time are reached and the median is reported.
+// GB/s is derived from a model of the bytes each stage must move per
+// interior cell (the fields it reads and writes once per pass), so it shows
+// how close a stage runs to memory bandwidth, not a measured counter.
+//
+// --json writes one result per line so runs can be diffed, and --compare
+// checks a run against such a file and fails on regressions.
+
+struct Options {
+    std::vector<uint32_t> sizes{128, 512, 1024};
+    std::vector<uint32_t> threads{1};
+    double minTime = 0.2;
+    uint32_t minSamples = 5;
+    std::string jsonPath, comparePath, filter;
+    float threshold = 0.10f;
+    FluidSolver::PressureSolver pressureSolver = FluidSolver::GAUSS_SEIDEL;
+    FluidSolver::RelaxOrder relaxation = FluidSolver::RED_BLACK;
+    FluidSolver::AdvectionScheme advection = FluidSolver::SEMI_LAGRANGIAN;
+    FluidSolver::Interpolation interpolation = FluidSolver::BILINEAR;
+    FluidSolver::DensityStorage densityStorage = FluidSolver::FLOAT32;
+    bool simd = true, blocked = false;
+};
+
+struct Result {
+    std::string stage;
+    uint32_t size, threads;
+    double medianNs, nsPerCell, gbPerSecond;
+};
+
+static void printUsage(const char* name) {
+    std::cout << "Usage: " << name << " [options]\n"
+              << "  --sizes N,N,...     square interior grid sizes (default 128,512,1024)\n"
+              << "  --threads N,N,...   thread counts (default 1)\n"
+              << "  --min-time S        minimum seconds per measurement (default 0.2)\n"
+              << "  --stage NAME        only run stages containing NAME\n"
+              << "  --relax ORDER       lex or redblack (default redblack)\n"
+              << "  --pressure NAME     gs (default), multigrid or cg\n"
+              << "  --advection NAME    sl (default), maccormack or bfecc\n"
+              << "  --cubic             monotonic cubic interpolation in advection\n"
+              << "  --no-simd           use the scalar kernels\n"
+              << "  --blocking          run the Gauss-Seidel sweeps as a wavefront\n"
+              << "  --density-storage NAME  float32 (default) or fixed16\n"
+              << "  --json FILE         write the results as JSON lines\n"
+              << "  --compare FILE      compare against a previous --json run\n"
+              << "  --threshold F       relative slowdown reported as regression (default 0.10)\n";
+}
+
+static std::vector<uint32_t> parseList(const std::string& text) {
+    std::vector<uint32_t> values;
+    std::stringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (!item.empty()) values.push_back((uint32_t) std::strtoul(item.c_str(), nullptr, 10));
+    }
+    return values;
+}
+
+static double measure(const std::function<void()>& fn, const Options& o) {
+    using clock = std::chrono::steady_clock;
+    fn(); // warm caches and the thread pool
+
+    std::vector<double> samples;
+    auto start = clock::now();
+    while (samples.size() < o.minSamples || std::chrono::duration<double>(clock::now() - start).count() < o.minTime) {
+        auto t0 = clock::now();
+        fn();
+        samples.push_back(std::chrono::duration<double, std::nano>(clock::now() - t0).count());
+    }
+    std::nth_element(samples.begin(), samples.begin() + samples.size()/2, samples.end());
+    return samples[samples.size()/2];
+}
+
+static void runSize(uint32_t size, uint32_t threads, const Options& o, std::vector<Result>& results) {
+    const float dt = 1.0f/60.0f;
+    FluidSolver solver{size, size};
+    solver.setThreadCount(threads);
+    solver.relaxation = o.relaxation;
+    solver.pressureSolver = o.pressureSolver;
+    solver.simd = o.simd;
+    solver.blockedSweeps = o.blocked;
+    solver.advection = o.advection;
+    solver.interpolation = o.interpolation;
+    solver.densityStorage = o.densityStorage;
+    solver.reset();
+
+    // Give the fields a realistic, non-zero state before timing
+    auto inject = [&] {
+        for (uint32_t k = 1; k <= 8; ++k) {
+            uint32_t i = size*k/9;
+            solver.addDensity(i, 2, 0.6f);
+            solver.setVelocity(i, 2, 0.0f, 1.0f);
+        }
+    };
+    for (int k = 0; k < 10; ++k) {
+        inject();
+        solver.step(dt);
+    }
+
+    auto& cur = solver.curState;
+    auto& prev = solver.prevState;
+    double cells = (double) size*size;
+    // Bytes per interior cell moved by one call, 4 bytes per float access
+    double pressureSweeps = solver.pressureIterations;
+    double densityBytes = o.densityStorage == FluidSolver::FIXED16 ? 2.0 : 4.0;
+    std::vector<std::pair<std::string, std::pair<std::function<void()>, double>>> stages{
+        {"diffuse", {[&] { solver.diffuse(prev.density, cur.density, solver.diffusionFactor, dt); }, 20*3*4.0}},
+        {"advect", {[&] { solver.advect(prev.density, cur.density, cur.velX, cur.velY, dt); }, 4*4.0}},
+        // Diffusion and advection of the density in its configured storage
+        {"densities", {[&] { solver.updateDensities(dt); }, (20*3 + 2)*densityBytes + 2*4.0}},
+        {"project", {[&] { solver.project(cur.velX, cur.velY, prev.velX, prev.velY); }, (4 + pressureSweeps*3 + 5)*4.0}},
+        {"setBounds", {[&] { solver.setBounds(cur.density); }, 0.0}},
+        {"step", {[&] { inject(); solver.step(dt); }, (2*20*3 + 2*(4 + pressureSweeps*3 + 5) + 2*5 + 20*3 + 4)*4.0}},
+    };
+
+    for (auto& stage : stages) {
+        if (!o.filter.empty() && stage.first.find(o.filter) == std::string::npos) continue;
+        double ns = measure(stage.second.first, o);
+        double bytes = stage.second.second*cells;
+        Result r{stage.first, size, solver.threadCount(), ns, ns/cells, bytes > 0 ? bytes/ns : 0.0};
+        std::printf("%-10s %5ux%-5u %2u thr  %12.0f ns  %8.3f ns/cell  %7.2f GB/s\n",
+                    r.stage.c_str(), size, size, r.threads, r.medianNs, r.nsPerCell, r.gbPerSecond);
+        results.push_back(r);
+    }
+}
+
+static std::string key(const std::string& stage, uint32_t size, uint32_t threads) {
+    return stage + " " + std::to_string(size) + " " + std::to_string(threads);
+}
+
+static bool writeJson(const std::string& path, const std::vector<Result>& results) {
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "Could not write " << path << std::endl;
+        return false;
+    }
+    file << "[\n";
+    for (size_t k = 0; k < results.size(); ++k) {
+        const auto& r = results[k];
+        char line[256];
+        std::snprintf(line, sizeof(line),
+                      "{\"stage\": \"%s\", \"size\": %u, \"threads\": %u, \"median_ns\": %.0f, \"ns_per_cell\": %.4f, \"gb_per_s\": %.3f}",
+                      r.stage.c_str(), r.size, r.threads, r.medianNs, r.nsPerCell, r.gbPerSecond);
+        file << "  " << line << (k + 1 < results.size() ? ",\n" : "\n");
+    }
+    file << "]\n";
+    return true;
+}
+
+// Reads back the files written by writeJson, one result per line
+static bool readJson(const std::string& path, std::map<std::string, double>& nsPerCell) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Could not open " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        char stage[64];
+        unsigned size, threads;
+        double medianNs, ns;
+        if (std::sscanf(line.c_str(), " {\"stage\": \"%63[^\"]\", \"size\": %u, \"threads\": %u, \"median_ns\": %lf, \"ns_per_cell\": %lf",
+                        stage, &size, &threads, &medianNs, &ns) == 5) {
+            nsPerCell[key(stage, size, threads)] = ns;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Options o;
+    for (int a = 1; a < argc; ++a) {
+        std::string arg = argv[a];
+        bool hasValue = a + 1 < argc;
+        if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return EXIT_SUCCESS;
+        } else if (arg == "--no-simd") {
+            o.simd = false;
+        } else if (arg == "--blocking") {
+            o.blocked = true;
+        } else if (arg == "--cubic") {
+            o.interpolation = FluidSolver::MONOTONIC_CUBIC;
+        } else if (!hasValue) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        } else if (arg == "--sizes") {
+            o.sizes = parseList(argv[++a]);
+        } else if (arg == "--threads") {
+            o.threads = parseList(argv[++a]);
+        } else if (arg == "--min-time") {
+            o.minTime = std::strtod(argv[++a], nullptr);
+        } else if (arg == "--stage") {
+            o.filter = argv[++a];
+        } else if (arg == "--relax") {
+            std::string name = argv[++a];
+            o.relaxation = name == "lex" ? FluidSolver::LEXICOGRAPHIC : FluidSolver::RED_BLACK;
+        } else if (arg == "--pressure") {
+            std::string name = argv[++a];
+            o.pressureSolver = name == "multigrid" ? FluidSolver::MULTIGRID
+                             : name == "cg" ? FluidSolver::CONJUGATE_GRADIENT : FluidSolver::GAUSS_SEIDEL;
+        } else if (arg == "--advection") {
+            std::string name = argv[++a];
+            o.advection = name == "maccormack" ? FluidSolver::MACCORMACK
+                        : name == "bfecc" ? FluidSolver::BFECC : FluidSolver::SEMI_LAGRANGIAN;
+        } else if (arg == "--density-storage") {
+            std::string name = argv[++a];
+            o.densityStorage = name == "fixed16" ? FluidSolver::FIXED16 : FluidSolver::FLOAT32;
+        } else if (arg == "--json") {
+            o.jsonPath = argv[++a];
+        } else if (arg == "--compare") {
+            o.comparePath = argv[++a];
+        } else if (arg == "--threshold") {
+            o.threshold = std::strtof(argv[++a], nullptr);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::cout << "kernels: " << (o.simd ? FluidSolver::simdName() : "scalar")
+              << ", " << (o.relaxation == FluidSolver::RED_BLACK ? "red-black" : "lexicographic")
+              << (o.blocked ? " blocked" : "")
+              << (o.densityStorage == FluidSolver::FIXED16 ? ", fixed16 density" : "")
+              << ", " << (o.pressureSolver == FluidSolver::MULTIGRID ? "multigrid"
+                          : o.pressureSolver == FluidSolver::CONJUGATE_GRADIENT ? "conjugate gradient" : "gauss-seidel")
+              << ", " << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+
+    std::vector<Result> results;
+    for (uint32_t size : o.sizes) {
+        for (uint32_t threads : o.threads) {
+            runSize(std::max(2u, size), std::max(1u, threads), o, results);
+        }
+    }
+
+    if (!o.jsonPath.empty() && !writeJson(o.jsonPath, results)) return EXIT_FAILURE;
+
+    if (!o.comparePath.empty()) {
+        std::map<std::string, double> baseline;
+        if (!readJson(o.comparePath, baseline)) return EXIT_FAILURE;
+        uint32_t regressions = 0;
+        for (const auto& r : results) {
+            auto it = baseline.find(key(r.stage, r.size, r.threads));
+            if (it == baseline.end() || it->second <= 0.0) continue;
+            double change = r.nsPerCell/it->second - 1.0;
+            bool regressed = change > o.threshold;
+            regressions += regressed;
+            std::printf("%-10s %5u %2u thr  %+7.1f%%%s\n", r.stage.c_str(), r.size, r.threads, change*100.0,
+                        regressed ? "  REGRESSION" : "");
+        }
+        if (regressions) {
+            std::cout << regressions << " regression(s) above " << o.threshold*100.0f << "%" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
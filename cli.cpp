@@ -0,0 +1,657 @@
+#include "Ensemble.h"
+#include "FixedTimestep.h"
+#include "FluidSolver.h"
+#include "InputEvents.h"
+#include "Profiler.h"
+#include "Snapshot.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Headless driver: steps the solver for a number of frames with a fixed dt,
+// applying forces read from a script, and dumps the fields as PFM images.
+//
+// Script lines are "<frame> <i> <j> <density> <velX> <velY>" (cell coordinates),
+// '#' starts a comment. A frame of -1 applies the force on every frame.
+//
+// --input replays an input log recorded by the viewer instead: its frame
+// times and pointer events go through the viewer's fixed timestep and
+// force mapping, so the fields match the recorded run bit for bit.
+//
+// --sweep runs one instance per combination of the listed parameter values
+// in a single Ensemble and prints a line of results per instance. The
+// script's velocities are scaled by each instance's speed.
+
+// Vector and scalar kernels evaluate the same expressions, so they should
+// match exactly; the tolerance only absorbs compilers that contract to FMA.
+static constexpr float SIMD_TOLERANCE = 1e-5f;
+
+struct ForceEvent {
+    int frame;
+    uint32_t i, j;
+    float density, velX, velY;
+};
+
+static void printUsage(const char* name) {
+    std::cout << "Usage: " << name << " [options]\n"
+              << "  --cells WxH       interior grid size (default 29x53, the web canvas)\n"
+              << "  --frames N        number of frames to step (default 300, or all of an --input log)\n"
+              << "  --dt S            fixed time step in seconds (default 1/60)\n"
+              << "  --script FILE     force script, see cli.cpp for the format\n"
+              << "  --input FILE      replay a viewer input log (grid, timestep and frames from the log)\n"
+              << "  --dump-every K    dump fields every K frames (default: last frame only)\n"
+              << "  --out PREFIX      prefix of the dumped files (default \"fluid\")\n"
+              << "  --no-dump         do not write any field\n"
+              << "  --threads N       solver threads, caller included (default 1)\n"
+              << "  --relax ORDER     Gauss-Seidel order: lex (default) or redblack\n"
+              << "  --no-simd         use the scalar kernels\n"
+              << "  --unfused         run every solver stage as a separate pass\n"
+              << "  --blocking        run the Gauss-Seidel sweeps as a cache-sized wavefront\n"
+              << "  --check-simd      also step a scalar solver and fail if the fields differ\n"
+              << "  --pressure NAME   pressure solver: gs (default), multigrid or cg\n"
+              << "  --pressure-iterations N   Gauss-Seidel sweeps / max V-cycles or CG iterations (default 20)\n"
+              << "  --pressure-tolerance T    relative residual target for multigrid and CG (default 1e-3)\n"
+              << "  --cold-start      start multigrid and CG from zero pressure, not the last solve\n"
+              << "  --max-cfl C       substep frames whose advection moves more than C cells (default 0, off)\n"
+              << "  --max-substeps N  cap on those substeps (default 4)\n"
+              << "  --advection NAME  sl (default), maccormack or bfecc\n"
+              << "  --cubic           monotonic cubic instead of bilinear interpolation in advection\n"
+              << "  --density-storage NAME  float32 (default) or fixed16, 16-bit fixed point in [0, 4]\n"
+              << "  --vorticity E     vorticity confinement strength (default 0, off)\n"
+              << "  --buoyancy B      upward acceleration per unit density (default 0)\n"
+              << "  --obstacles FILE  solid cells from a PGM image, dark pixels are walls\n"
+              << "  --sparse          only step the 16x16 tiles holding smoke or motion\n"
+              << "  --record FILE     stream the fields to a snapshot recording\n"
+              << "  --record-fields S density, state (default) or checkpoint (with prevState)\n"
+              << "  --record-every K  record every K frames (default 1)\n"
+              << "  --record-f16      store half floats\n"
+              << "  --record-delta    delta + zero-run compression between keyframes\n"
+              << "  --resume FILE     start from the last frame of a checkpoint recording\n"
+              << "  --inspect FILE    print a recording's header and per-frame density, then exit\n"
+              << "  --profile         print per-stage min/avg/p99 timings\n"
+              << "  --trace FILE      write the last frames as a Chrome trace (chrome://tracing)\n"
+              << "  --viscosity V     --diffusion D     --dissolve R\n"
+              << "  --sweep NAME=V,V  sweep viscosity, diffusion, dissolve or speed over the values;\n"
+              << "                    repeat for a grid of combinations, --threads spreads the instances;\n"
+              << "                    prints per-instance results instead of dumping fields\n";
+}
+
+static bool loadScript(const std::string& path, const FluidSolver& solver, std::vector<ForceEvent>& events) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Could not open script " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    uint32_t lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        auto comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+        std::istringstream in(line);
+        ForceEvent e{};
+        if (!(in >> e.frame)) continue;
+        if (!(in >> e.i >> e.j >> e.density >> e.velX >> e.velY)) {
+            std::cerr << path << ":" << lineNumber << ": expected <frame> <i> <j> <density> <velX> <velY>" << std::endl;
+            return false;
+        }
+        if (e.i < 1 || e.i > solver.numTilesMiddleX() || e.j < 1 || e.j > solver.numTilesMiddleY()) {
+            std::cerr << path << ":" << lineNumber << ": cell outside of the grid" << std::endl;
+            return false;
+        }
+        events.push_back(e);
+    }
+    return true;
+}
+
+static void writePfm(const std::string& path, const FluidSolver::Field& field) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Could not write " << path << std::endl;
+        return;
+    }
+    // PFM stores rows bottom to top, which is the solver's j order
+    file << "Pf\n" << field.width() << " " << field.height() << "\n-1.0\n";
+    for (uint32_t j = 0; j < field.height(); ++j) {
+        for (uint32_t i = 0; i < field.width(); ++i) {
+            float v = field(i, j);
+            file.write(reinterpret_cast<const char*>(&v), sizeof(float));
+        }
+    }
+}
+
+static void dumpFields(const std::string& prefix, uint32_t frame, const FluidSolver::FluidData& data) {
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), "_%05u", frame);
+    writePfm(prefix + suffix + "_density.pfm", data.density);
+    writePfm(prefix + suffix + "_velX.pfm", data.velX);
+    writePfm(prefix + suffix + "_velY.pfm", data.velY);
+}
+
+struct Options {
+    uint32_t frames = 300, dumpEvery = 0, cellsX = 29, cellsY = 53;
+    float dt = 1.0f/60.0f;
+    float viscosity = 0.005f, diffusion = 0.001f, dissolve = 0.02f;
+    bool framesSet = false, dump = true, simd = true, checkSimd = false, fused = true, profile = false, sparse = false;
+    bool blocked = false;
+    std::string scriptPath, inputPath, obstaclesPath, prefix = "fluid", tracePath;
+    std::string recordPath, resumePath, inspectPath;
+    uint32_t recordFields = snapshot::STATE, recordEvery = 1;
+    snapshot::Encoding recordEncoding = snapshot::FLOAT32;
+    snapshot::Compression recordCompression = snapshot::NONE;
+    FluidSolver::PressureSolver pressureSolver = FluidSolver::GAUSS_SEIDEL;
+    uint32_t pressureIterations = 20, threads = 1;
+    float pressureTolerance = 1e-3f;
+    bool warmStart = true;
+    float maxCfl = 0.0f, vorticity = 0.0f, buoyancy = 0.0f;
+    uint32_t maxSubsteps = 4;
+    FluidSolver::RelaxOrder relaxation = FluidSolver::LEXICOGRAPHIC;
+    FluidSolver::AdvectionScheme advection = FluidSolver::SEMI_LAGRANGIAN;
+    FluidSolver::Interpolation interpolation = FluidSolver::BILINEAR;
+    FluidSolver::DensityStorage densityStorage = FluidSolver::FLOAT32;
+    // Swept values, empty when the parameter keeps its single value
+    std::vector<float> sweepViscosity, sweepDiffusion, sweepDissolve, sweepSpeed;
+    bool sweep = false;
+    // Loaded from obstaclesPath and the input log's solid cells once the grid size is known
+    Obstacles obstacles;
+};
+
+static void configure(FluidSolver& solver, const Options& o) {
+    solver.viscosity = o.viscosity;
+    solver.diffusionFactor = o.diffusion;
+    solver.dissolveFactor = o.dissolve;
+    solver.setThreadCount(o.threads);
+    solver.relaxation = o.relaxation;
+    solver.simd = o.simd;
+    solver.blockedSweeps = o.blocked;
+    solver.fusedStep = o.fused;
+    solver.pressureSolver = o.pressureSolver;
+    solver.pressureIterations = o.pressureIterations;
+    solver.pressureTolerance = o.pressureTolerance;
+    solver.warmStart = o.warmStart;
+    solver.maxCfl = o.maxCfl;
+    solver.maxSubsteps = o.maxSubsteps;
+    solver.sparseTiles = o.sparse;
+    solver.advection = o.advection;
+    solver.vorticity = o.vorticity;
+    solver.buoyancy = o.buoyancy;
+    solver.interpolation = o.interpolation;
+    solver.densityStorage = o.densityStorage;
+    if (!o.obstacles.empty()) solver.obstacles = o.obstacles;
+    solver.reset();
+}
+
+static void applyEvents(FluidSolver& solver, const std::vector<ForceEvent>& events, uint32_t frame) {
+    for (const auto& e : events) {
+        if (e.frame != -1 && (uint32_t) e.frame != frame) continue;
+        solver.addDensity(e.i, e.j, e.density);
+        solver.setVelocity(e.i, e.j, e.velX, e.velY);
+    }
+}
+
+static bool parseSweep(const std::string& spec, Options& o) {
+    auto equals = spec.find('=');
+    std::string name = spec.substr(0, equals);
+    std::vector<float>* values = name == "viscosity" ? &o.sweepViscosity
+                               : name == "diffusion" ? &o.sweepDiffusion
+                               : name == "dissolve" ? &o.sweepDissolve
+                               : name == "speed" ? &o.sweepSpeed : nullptr;
+    if (!values || equals == std::string::npos) {
+        std::cerr << "Invalid sweep " << spec << ", expected viscosity|diffusion|dissolve|speed=V,V,..." << std::endl;
+        return false;
+    }
+    std::stringstream in(spec.substr(equals + 1));
+    std::string item;
+    values->clear();
+    while (std::getline(in, item, ',')) {
+        if (!item.empty()) values->push_back(std::strtof(item.c_str(), nullptr));
+    }
+    o.sweep = !values->empty();
+    return o.sweep;
+}
+
+// Steps every combination of the swept values side by side and prints one
+// result line per instance
+static int runSweep(const Options& o, const std::vector<ForceEvent>& events) {
+    auto valuesOr = [](const std::vector<float>& values, float value) {
+        return values.empty() ? std::vector<float>{value} : values;
+    };
+    Ensemble ensemble{o.cellsX, o.cellsY};
+    for (float viscosity : valuesOr(o.sweepViscosity, o.viscosity)) {
+        for (float diffusion : valuesOr(o.sweepDiffusion, o.diffusion)) {
+            for (float dissolve : valuesOr(o.sweepDissolve, o.dissolve)) {
+                for (float speed : valuesOr(o.sweepSpeed, 1.0f)) {
+                    FluidSolver& solver = ensemble.add({viscosity, diffusion, dissolve, speed});
+                    Options single = o;
+                    single.threads = 1;
+                    single.viscosity = viscosity;
+                    single.diffusion = diffusion;
+                    single.dissolve = dissolve;
+                    configure(solver, single);
+                }
+            }
+        }
+    }
+    ensemble.setThreadCount(o.threads);
+
+    uint32_t frame = 0;
+    auto forces = [&](uint32_t, FluidSolver& solver, const Ensemble::Params& params) {
+        for (const auto& e : events) {
+            if (e.frame != -1 && (uint32_t) e.frame != frame) continue;
+            solver.addDensity(e.i, e.j, e.density);
+            solver.setVelocity(e.i, e.j, params.initialSpeed*e.velX, params.initialSpeed*e.velY);
+        }
+    };
+    auto start = std::chrono::steady_clock::now();
+    for (frame = 0; frame < o.frames; ++frame) ensemble.step(o.dt, forces);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "instance viscosity diffusion dissolve speed total_density max_density max_speed steps ms\n";
+    for (uint32_t k = 0; k < ensemble.size(); ++k) {
+        const Ensemble::Params& p = ensemble.params(k);
+        Ensemble::Output out = ensemble.output(k);
+        std::cout << k << " " << p.viscosity << " " << p.diffusionFactor << " " << p.dissolveFactor << " "
+                  << p.initialSpeed << " " << out.totalDensity << " " << out.maxDensity << " " << out.maxSpeed
+                  << " " << out.steps << " " << out.seconds*1000.0 << "\n";
+    }
+    std::cout << ensemble.size() << " instances of " << o.cellsX << "x" << o.cellsY << ", " << o.frames
+              << " frames on " << ensemble.threadCount() << " thread(s): " << seconds*1000.0 << " ms" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+static float maxDifference(const FluidSolver::Field& a, const FluidSolver::Field& b) {
+    float diff = 0.0f;
+    for (uint32_t j = 0; j < a.height(); ++j) {
+        for (uint32_t i = 0; i < a.width(); ++i) {
+            diff = std::max(diff, std::abs(a(i, j) - b(i, j)));
+        }
+    }
+    return diff;
+}
+
+// Offline look at a recording: what it holds and how the density evolves
+static int inspect(const std::string& path) {
+    SnapshotReader reader;
+    if (!reader.open(path)) return EXIT_FAILURE;
+    const snapshot::FileHeader& h = reader.header();
+    std::cout << "grid: " << h.width - 2 << "x" << h.height - 2 << ", " << reader.frameCount() << " frames, "
+              << (h.encoding == snapshot::FLOAT16 ? "float16" : "float32")
+              << (h.compression == snapshot::DELTA ? ", delta" : "") << "\n"
+              << "dt " << h.dt << ", viscosity " << h.viscosity << ", diffusion " << h.diffusion
+              << ", dissolve " << h.dissolve << std::endl;
+    if (reader.missingFrames()) std::cout << "missing: " << reader.missingFrames() << " frames" << std::endl;
+    if (h.frames == 0) std::cout << "not closed by its writer, frames at the end may be missing" << std::endl;
+    if (!reader.hasField(snapshot::DENSITY)) return EXIT_SUCCESS;
+
+    for (uint32_t frame = 0; frame < reader.frameCount(); ++frame) {
+        const float* density = reader.field(frame, snapshot::DENSITY);
+        if (!density) {
+            std::cerr << "frame " << frame << " is corrupt" << std::endl;
+            return EXIT_FAILURE;
+        }
+        double total = 0.0;
+        float maxDensity = 0.0f;
+        for (uint32_t j = 1; j + 1 < h.height; ++j) {
+            for (uint32_t i = 1; i + 1 < h.width; ++i) {
+                total += density[(size_t) h.width*j + i];
+                maxDensity = std::max(maxDensity, density[(size_t) h.width*j + i]);
+            }
+        }
+        std::cout << reader.frameIndex(frame) << " " << total << " " << maxDensity << "\n";
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+    Options o;
+
+    for (int a = 1; a < argc; ++a) {
+        std::string arg = argv[a];
+        bool hasValue = a + 1 < argc;
+        if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return EXIT_SUCCESS;
+        } else if (arg == "--no-dump") {
+            o.dump = false;
+        } else if (arg == "--no-simd") {
+            o.simd = false;
+        } else if (arg == "--blocking") {
+            o.blocked = true;
+        } else if (arg == "--unfused") {
+            o.fused = false;
+        } else if (arg == "--check-simd") {
+            o.checkSimd = true;
+        } else if (arg == "--record-f16") {
+            o.recordEncoding = snapshot::FLOAT16;
+        } else if (arg == "--record-delta") {
+            o.recordCompression = snapshot::DELTA;
+        } else if (arg == "--cubic") {
+            o.interpolation = FluidSolver::MONOTONIC_CUBIC;
+        } else if (arg == "--sparse") {
+            o.sparse = true;
+        } else if (arg == "--profile") {
+            o.profile = true;
+        } else if (arg == "--cold-start") {
+            o.warmStart = false;
+        } else if (!hasValue) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        } else if (arg == "--cells") {
+            if (std::sscanf(argv[++a], "%ux%u", &o.cellsX, &o.cellsY) != 2 || o.cellsX < 2 || o.cellsY < 2) {
+                std::cerr << "Invalid grid size " << argv[a] << ", expected WxH" << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--frames") {
+            o.frames = (uint32_t) std::strtoul(argv[++a], nullptr, 10);
+            o.framesSet = true;
+        } else if (arg == "--dt") {
+            o.dt = std::strtof(argv[++a], nullptr);
+        } else if (arg == "--script") {
+            o.scriptPath = argv[++a];
+        } else if (arg == "--sweep") {
+            if (!parseSweep(argv[++a], o)) return EXIT_FAILURE;
+        } else if (arg == "--obstacles") {
+            o.obstaclesPath = argv[++a];
+        } else if (arg == "--input") {
+            o.inputPath = argv[++a];
+        } else if (arg == "--record") {
+            o.recordPath = argv[++a];
+        } else if (arg == "--record-fields") {
+            std::string name = argv[++a];
+            if (name == "density") {
+                o.recordFields = snapshot::DENSITY_ONLY;
+            } else if (name == "state") {
+                o.recordFields = snapshot::STATE;
+            } else if (name == "checkpoint") {
+                o.recordFields = snapshot::CHECKPOINT;
+            } else {
+                std::cerr << "Unknown field set " << name << ", expected density, state or checkpoint" << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--record-every") {
+            o.recordEvery = std::max(1u, (uint32_t) std::strtoul(argv[++a], nullptr, 10));
+        } else if (arg == "--resume") {
+            o.resumePath = argv[++a];
+        } else if (arg == "--inspect") {
+            o.inspectPath = argv[++a];
+        } else if (arg == "--trace") {
+            o.tracePath = argv[++a];
+        } else if (arg == "--dump-every") {
+            o.dumpEvery = (uint32_t) std::strtoul(argv[++a], nullptr, 10);
+        } else if (arg == "--out") {
+            o.prefix = argv[++a];
+        } else if (arg == "--threads") {
+            o.threads = std::max(1u, (uint32_t) std::strtoul(argv[++a], nullptr, 10));
+        } else if (arg == "--relax") {
+            std::string name = argv[++a];
+            if (name == "lex") {
+                o.relaxation = FluidSolver::LEXICOGRAPHIC;
+            } else if (name == "redblack") {
+                o.relaxation = FluidSolver::RED_BLACK;
+            } else {
+                std::cerr << "Unknown relaxation order " << name << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--advection") {
+            std::string name = argv[++a];
+            if (name == "sl") {
+                o.advection = FluidSolver::SEMI_LAGRANGIAN;
+            } else if (name == "maccormack") {
+                o.advection = FluidSolver::MACCORMACK;
+            } else if (name == "bfecc") {
+                o.advection = FluidSolver::BFECC;
+            } else {
+                std::cerr << "Unknown advection scheme " << name << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--density-storage") {
+            std::string name = argv[++a];
+            if (name == "float32") {
+                o.densityStorage = FluidSolver::FLOAT32;
+            } else if (name == "fixed16") {
+                o.densityStorage = FluidSolver::FIXED16;
+            } else {
+                std::cerr << "Unknown density storage " << name << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--pressure") {
+            std::string name = argv[++a];
+            if (name == "gs") {
+                o.pressureSolver = FluidSolver::GAUSS_SEIDEL;
+            } else if (name == "multigrid") {
+                o.pressureSolver = FluidSolver::MULTIGRID;
+            } else if (name == "cg") {
+                o.pressureSolver = FluidSolver::CONJUGATE_GRADIENT;
+            } else {
+                std::cerr << "Unknown pressure solver " << name << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--pressure-iterations") {
+            o.pressureIterations = (uint32_t) std::strtoul(argv[++a], nullptr, 10);
+        } else if (arg == "--pressure-tolerance") {
+            o.pressureTolerance = std::strtof(argv[++a], nullptr);
+        } else if (arg == "--max-cfl") {
+            o.maxCfl = std::strtof(argv[++a], nullptr);
+        } else if (arg == "--max-substeps") {
+            o.maxSubsteps = (uint32_t) std::strtoul(argv[++a], nullptr, 10);
+        } else if (arg == "--vorticity") {
+            o.vorticity = std::strtof(argv[++a], nullptr);
+        } else if (arg == "--buoyancy") {
+            o.buoyancy = std::strtof(argv[++a], nullptr);
+        } else if (arg == "--viscosity") {
+            o.viscosity = std::strtof(argv[++a], nullptr);
+        } else if (arg == "--diffusion") {
+            o.diffusion = std::strtof(argv[++a], nullptr);
+        } else if (arg == "--dissolve") {
+            o.dissolve = std::strtof(argv[++a], nullptr);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!o.inspectPath.empty()) return inspect(o.inspectPath);
+
+    if (o.sweep && (!o.inputPath.empty() || !o.resumePath.empty() || !o.recordPath.empty() || o.checkSimd)) {
+        std::cerr << "--sweep does not combine with --input, --resume, --record or --check-simd" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    SnapshotReader resume;
+    if (!o.resumePath.empty()) {
+        if (!resume.open(o.resumePath)) return EXIT_FAILURE;
+        if (resume.frameCount() == 0 || (resume.header().fields & snapshot::STATE) != snapshot::STATE) {
+            std::cerr << o.resumePath << " has no solver state to resume from" << std::endl;
+            return EXIT_FAILURE;
+        }
+        // Its last stored frame need not be the last one recorded
+        if (resume.missingFrames()) {
+            std::cerr << o.resumePath << " is missing " << resume.missingFrames()
+                      << " frames that were dropped while recording; not resuming from it" << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (resume.header().frames == 0) {
+            std::cerr << "warning: " << o.resumePath << " was not closed by its writer, frames at the end may be missing"
+                      << std::endl;
+        }
+        o.cellsX = resume.header().width - 2;
+        o.cellsY = resume.header().height - 2;
+    }
+
+    InputLog input;
+    if (!o.inputPath.empty()) {
+        if (!input.load(o.inputPath)) return EXIT_FAILURE;
+        const InputLog::Settings& settings = input.settings();
+        o.cellsX = settings.cellsX;
+        o.cellsY = settings.cellsY;
+        o.dt = settings.stepSize;
+        o.maxCfl = settings.maxCfl;
+        o.maxSubsteps = settings.maxSubsteps;
+        o.sparse = settings.sparseTiles;
+        o.viscosity = settings.viscosity;
+        o.diffusion = settings.diffusionFactor;
+        o.dissolve = settings.dissolveFactor;
+        o.advection = settings.advection;
+        o.interpolation = settings.interpolation;
+        o.vorticity = settings.vorticity;
+        o.buoyancy = settings.buoyancy;
+        auto logged = (uint32_t) input.frames().size();
+        o.frames = o.framesSet ? std::min(o.frames, logged) : logged;
+    }
+
+    o.obstacles.resize(o.cellsX, o.cellsY);
+    if (!o.obstaclesPath.empty() && !o.obstacles.loadPgm(o.obstaclesPath)) return EXIT_FAILURE;
+    const std::vector<uint32_t>& solidRuns = input.settings().solidRuns;
+    for (size_t k = 0; k + 2 < solidRuns.size(); k += 3) {
+        for (uint32_t i = solidRuns[k + 1]; i <= solidRuns[k + 2]; ++i) o.obstacles.set(i, solidRuns[k], true);
+    }
+    o.obstacles.update();
+
+    FluidSolver solver{o.cellsX, o.cellsY};
+    configure(solver, o);
+    if (!o.resumePath.empty()) {
+        resume.load(resume.frameCount() - 1, solver);
+        std::cout << "resuming from recorded frame " << resume.frameIndex(resume.frameCount() - 1) << std::endl;
+    }
+
+    // Offline runs wait for the writer rather than drop frames
+    SnapshotWriter recorder{4, true};
+    if (!o.recordPath.empty()) {
+        snapshot::FileHeader header = snapshot::headerFor(solver, o.recordFields, o.dt);
+        header.encoding = o.recordEncoding;
+        header.compression = o.recordCompression;
+        if (!recorder.open(o.recordPath, header)) return EXIT_FAILURE;
+    }
+
+    std::vector<ForceEvent> events;
+    if (!o.inputPath.empty()) {
+        // The log's own pointer events drive the run
+    } else if (!o.scriptPath.empty()) {
+        if (!loadScript(o.scriptPath, solver, events)) return EXIT_FAILURE;
+    } else {
+        // Default workload: a plume rising from the bottom centre
+        events.push_back({-1, solver.numTilesMiddleX()/2, 2, 0.6f, 0.0f, 1.0f});
+    }
+
+    if (o.sweep) return runSweep(o, events);
+
+    // Runs the scalar kernels next to the vector ones and reports how far they drift apart
+    std::unique_ptr<FluidSolver> reference;
+    float simdDifference = 0.0f;
+    if (o.checkSimd) {
+        reference = std::make_unique<FluidSolver>(o.cellsX, o.cellsY);
+        configure(*reference, o);
+        reference->simd = false;
+        solver.simd = true;
+    }
+
+    Profiler profiler{1024};
+    if (o.profile || !o.tracePath.empty()) Profiler::setActive(&profiler);
+
+    // Input replays run the logged steps of each batch; version 1 logs turn
+    // the frame times into fixed steps like the viewer did
+    const InputLog::Settings& inputSettings = input.settings();
+    FixedTimestep timestep, referenceTimestep;
+    timestep.setStepSize(inputSettings.stepSize);
+    timestep.maxSteps = inputSettings.maxSteps;
+    referenceTimestep = timestep;
+    InputForces forces{inputSettings.canvasWidth, inputSettings.canvasHeight};
+    InputForces referenceForces = forces;
+    auto stepFrame = [&](FluidSolver& s, FixedTimestep& t, InputForces& f, uint32_t frame) -> uint32_t {
+        if (o.inputPath.empty()) {
+            applyEvents(s, events, frame);
+            return s.advance(o.dt);
+        }
+        const InputLog::Frame& logged = input.frames()[frame];
+        uint32_t steps = logged.steps >= 0 ? (uint32_t) logged.steps : t.advance(logged.elapsed), taken = 0;
+        f.frame(s, logged.events, logged.elapsed, steps);
+        for (uint32_t k = 0; k < steps; ++k) taken += s.advance(t.stepSize());
+        return taken;
+    };
+
+    double solverSeconds = 0.0;
+    uint64_t substeps = 0;
+    for (uint32_t frame = 0; frame < o.frames; ++frame) {
+        profiler.beginFrame();
+        auto start = std::chrono::high_resolution_clock::now();
+        substeps += stepFrame(solver, timestep, forces, frame);
+        auto end = std::chrono::high_resolution_clock::now();
+        profiler.endFrame();
+        solverSeconds += std::chrono::duration<double>(end - start).count();
+        // Everything below reads the float density
+        solver.unpackDensity();
+
+        if (reference) {
+            stepFrame(*reference, referenceTimestep, referenceForces, frame);
+            reference->unpackDensity();
+            simdDifference = std::max({simdDifference,
+                                       maxDifference(solver.curState.density, reference->curState.density),
+                                       maxDifference(solver.curState.velX, reference->curState.velX),
+                                       maxDifference(solver.curState.velY, reference->curState.velY)});
+        }
+
+        if (!o.recordPath.empty() && (frame + 1) % o.recordEvery == 0) recorder.push(solver);
+
+        bool last = frame + 1 == o.frames;
+        if (o.dump && ((o.dumpEvery && (frame + 1) % o.dumpEvery == 0) || (last && !o.dumpEvery))) {
+            dumpFields(o.prefix, frame + 1, solver.curState);
+        }
+    }
+
+    double totalDensity = 0.0;
+    float maxSpeed = 0.0f;
+    for (uint32_t j = 1; j <= solver.numTilesMiddleY(); ++j) {
+        for (uint32_t i = 1; i <= solver.numTilesMiddleX(); ++i) {
+            totalDensity += solver.curState.density(i, j);
+            maxSpeed = std::max(maxSpeed, std::hypot(solver.curState.velX(i, j), solver.curState.velY(i, j)));
+        }
+    }
+
+    std::cout << "frames: " << o.frames << "\n"
+              << "grid: " << solver.numTilesMiddleX() << "x" << solver.numTilesMiddleY()
+              << (solver.usesFixedShape() ? " (fixed)" : "") << ", " << solver.threadCount() << " thread(s), "
+              << (solver.simd ? FluidSolver::simdName() : "scalar") << "\n"
+              << "solver time: " << solverSeconds*1000.0 << " ms (" << (o.frames ? solverSeconds*1000.0/o.frames : 0.0) << " ms/frame)\n"
+              << "total density: " << totalDensity << "\n"
+              << "max speed: " << maxSpeed << "\n"
+              << "solver steps: " << substeps << "\n"
+              << "last pressure solve: " << solver.lastPressureStats.iterations << " iterations";
+    if (solver.lastPressureStats.residual >= 0.0f) std::cout << ", residual " << solver.lastPressureStats.residual;
+    std::cout << std::endl;
+    if (solver.sparseTiles && solver.pressureSolver == FluidSolver::GAUSS_SEIDEL) {
+        const ActiveTiles& tiles = solver.activeTiles();
+        std::cout << "active tiles: " << tiles.activeCount() << " of " << tiles.tileCount() << std::endl;
+    }
+
+    Profiler::setActive(nullptr);
+    if (!o.recordPath.empty()) {
+        recorder.close();
+        std::cout << "recorded: " << recorder.framesWritten() << " frames, " << recorder.bytesWritten() << " bytes"
+                  << std::endl;
+        if (recorder.framesDropped()) {
+            std::cerr << o.recordPath << " is missing " << recorder.framesDropped() << " dropped frames" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (o.profile) profiler.printStats(std::cout);
+    if (!o.tracePath.empty() && !profiler.writeChromeTrace(o.tracePath)) return EXIT_FAILURE;
+
+    if (reference) {
+        std::cout << "simd check (" << FluidSolver::simdName() << " vs scalar): max |diff| " << simdDifference << std::endl;
+        if (simdDifference > SIMD_TOLERANCE) return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -8,35 +8,22 @@
 #include "external/glad.h"
 #endif
 #include <GLFW/glfw3.h>
+#include <algorithm>
 #include <functional>
 #include <vector>
 #include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include "BackgroundWorker.h"
+#include "DensityTexture.h"
+#include "FixedTimestep.h"
 #include "Grid2D.h"
-
-template<typename T, size_t size, uint32_t row>
-class Matrix{
-public:
-
-    void swap(Matrix& other){
-        m_matrix.swap(other.m_matrix);
-    }
-
-    constexpr T& operator() (uint32_t i, uint32_t j) {
-        return m_matrix[i + row*j];
-    }
-    constexpr const T& operator()(uint32_t i, uint32_t j) const{
-        return m_matrix[i + row*j];
-    }
-    constexpr T& operator[] (uint32_t i) {
-        return m_matrix[i];
-    }
-    constexpr const T& operator[](uint32_t i) const{
-        return m_matrix[i];
-    }
-
-private:
-    std::array<T, size> m_matrix{};
-};
+#include "FluidSolver.h"
+#include "InputEvents.h"
+#include "Profiler.h"
+#include "Snapshot.h"
 
 const char *vertexShaderSource = "#version 330 core\n"
                                  "layout (location = 0) in vec3 inPos;\n"
@@ -71,26 +58,48 @@ const char *fragmentShaderSourceWeb = "precision mediump float;"
                                    "   gl_FragColor = vec4(fragColor, 1);\n"
                                    "}\n\0";
 
+// Density texture on a fullscreen quad
+const char *textureVertexShaderSource = "#version 330 core\n"
+                                        "layout (location = 0) in vec2 inPos;\n"
+                                        "layout (location = 1) in vec2 inUv;\n"
+                                        "out vec2 uv;\n"
+                                        "void main()\n"
+                                        "{\n"
+                                        "   gl_Position = vec4(inPos, 0.0, 1.0);\n"
+                                        "   uv = inUv;\n"
+                                        "}\0";
+const char *textureFragmentShaderSource = "#version 330 core\n"
+                                          "in vec2 uv;\n"
+                                          "uniform sampler2D density;\n"
+                                          "out vec4 outColor;\n"
+                                          "void main()\n"
+                                          "{\n"
+                                          "   outColor = vec4(vec3(texture(density, uv).r), 1.0f);\n"
+                                          "}\n\0";
+
+const char *textureVertexShaderSourceWeb = "precision mediump float;"
+                                           "attribute vec2 coordinates;\n"
+                                           "attribute vec2 texCoords;\n"
+                                           "varying vec2 uv;\n"
+                                           "void main()\n"
+                                           "{\n"
+                                           "   gl_Position = vec4(coordinates, 0.0, 1.0);\n"
+                                           "   uv = texCoords;\n"
+                                           "}\0";
+const char *textureFragmentShaderSourceWeb = "precision mediump float;"
+                                             "varying vec2 uv;"
+                                             "uniform sampler2D density;"
+                                             "void main()\n"
+                                             "{\n"
+                                             "   gl_FragColor = vec4(texture2D(density, uv).rgb, 1);\n"
+                                             "}\n\0";
+
 class FluidSimulation {
 public:
     static std::function<void()> loop;
     static constexpr int WIDTH = 450;
     static constexpr int HEIGHT = 810;
     static constexpr uint32_t SIZE = 15;
-    constexpr static uint32_t numTilesX = WIDTH/SIZE + 1;
-    constexpr static uint32_t numTilesMiddleX = numTilesX - 2;
-    constexpr static uint32_t numTilesY = HEIGHT/SIZE + 1;
-    constexpr static uint32_t numTilesMiddleY = numTilesY - 2;
-    constexpr static uint32_t INSTANCE_COUNT = numTilesX*numTilesY;
-
-    struct FluidData {
-        Matrix<float, INSTANCE_COUNT, numTilesX> density{}, velX{}, velY{};
-    };
-
-    enum BoundConfig {
-        REGULAR, MIRROR_X, MIRROR_Y
-    };
-
     explicit FluidSimulation(GLFWwindow* glfwWindow): window(glfwWindow) {
         // Initialize glfw
         if (!glfwInit())
@@ -117,12 +126,20 @@ public:
         }
 #endif
 
-    grid.createGrid(WIDTH, HEIGHT, SIZE);
+
+        glfwSetWindowUserPointer(window, this);
+        glfwSetKeyCallback(window, onKey);
+        glfwSetCursorPosCallback(window, onCursorPos);
+        glfwSetMouseButtonCallback(window, onMouseButton);
+        Profiler::setActive(&profiler);
+        solver.maxCfl = 1.0f;
     }
 
     ~FluidSimulation() {
+        Profiler::setActive(nullptr);
         glDeleteProgram(shaderProgram);
         grid.deleteBuffers();
+        densityTexture.deleteBuffers();
         glfwDestroyWindow(window);
         glfwTerminate();
     }
@@ -134,15 +151,25 @@ public:
     }
 
     void createShaders(){
+#ifndef __EMSCRIPTEN__
+        if (renderMode == MESH) shaderProgram = buildProgram(vertexShaderSource, fragmentShaderSource);
+        else shaderProgram = buildProgram(textureVertexShaderSource, textureFragmentShaderSource);
+#else
+        if (renderMode == MESH) shaderProgram = buildProgram(vertexShaderSourceWeb, fragmentShaderSourceWeb);
+        else shaderProgram = buildProgram(textureVertexShaderSourceWeb, textureFragmentShaderSourceWeb);
+#endif
+        if (renderMode == TEXTURE) {
+            glUseProgram(shaderProgram);
+            glUniform1i(glGetUniformLocation(shaderProgram, "density"), 0);
+        }
+    }
+
+    static GLuint buildProgram(const char* vertexSource, const char* fragmentSource) {
         // build and compile our shader program
         // ------------------------------------
         // vertex shader
         unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-#ifndef __EMSCRIPTEN__
-        glShaderSource(vertexShader, 1, &vertexShaderSource, nullptr);
-#else
-        glShaderSource(vertexShader, 1, &vertexShaderSourceWeb, nullptr);
-#endif
+        glShaderSource(vertexShader, 1, &vertexSource, nullptr);
         glCompileShader(vertexShader);
         // check for shader compile errors
         int success;
@@ -155,11 +182,7 @@ public:
         }
         // fragment shader
         unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-#ifndef __EMSCRIPTEN__
-        glShaderSource(fragmentShader, 1, &fragmentShaderSource, nullptr);
-#else
-        glShaderSource(fragmentShader, 1, &fragmentShaderSourceWeb, nullptr);
-#endif
+        glShaderSource(fragmentShader, 1, &fragmentSource, nullptr);
         glCompileShader(fragmentShader);
         // check for shader compile errors
         glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
@@ -169,28 +192,34 @@ public:
             std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
         }
         // link shaders
-        shaderProgram = glCreateProgram();
-        glAttachShader(shaderProgram, vertexShader);
-        glAttachShader(shaderProgram, fragmentShader);
-        glLinkProgram(shaderProgram);
+        GLuint program = glCreateProgram();
+        glAttachShader(program, vertexShader);
+        glAttachShader(program, fragmentShader);
+        // The web shaders have no layout qualifiers; names a shader lacks are ignored
+        glBindAttribLocation(program, 0, "coordinates");
+        glBindAttribLocation(program, 1, "color");
+        glBindAttribLocation(program, 1, "texCoords");
+        glLinkProgram(program);
         // check for linking errors
-        glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
         if (!success) {
-            glGetProgramInfoLog(shaderProgram, 512, nullptr, infoLog);
+            glGetProgramInfoLog(program, 512, nullptr, infoLog);
             std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
         }
         glDeleteShader(vertexShader);
         glDeleteShader(fragmentShader);
+        return program;
     }
 
     void initializeObjects(){
-        for (uint32_t i = 0; i < grid.size(); i++) {
-            curState.velX[i] = 0.0f;
-            curState.velY[i] = 0.0f;
-            curState.density[i] = 0.0f;
-            prevState.velX[i] = 0.0f;
-            prevState.velY[i] = 0.0f;
-            prevState.density[i] = 0.0f;
+        solver.reset();
+        if (renderMode == MESH) {
+            grid.createGrid(WIDTH, HEIGHT, SIZE);
+            // The solver writes the density straight into the vertex colours
+            solver.colorTarget = {grid.colorData(), Grid2D::VERTEX_FLOATS, Grid2D::VERTEX_FLOATS*solver.numTilesX(), 3};
+        } else {
+            densityTexture.create(solver.numTilesX(), solver.numTilesY(), textureFormat);
+            solver.colorTarget = {};
         }
     }
 
@@ -200,184 +229,246 @@ public:
         initializeObjects();
 
         loop = [this] {
+            profiler.beginFrame();
             static auto currentTime = std::chrono::high_resolution_clock::now();
             auto newTime = std::chrono::high_resolution_clock::now();
             float deltaTime = std::chrono::duration<float, std::chrono::seconds::period>(newTime - currentTime).count();
             currentTime = newTime;
-            deltaT = deltaTime;
-
-            glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-            glClear(GL_COLOR_BUFFER_BIT);
+            std::vector<InputEvent> events;
+            events.swap(pendingInput);
+            uint32_t steps = inputReplay.frames().size() > 0 ? nextReplayedInput(deltaTime, events)
+                                                             : timestep.advance(deltaTime);
+            PROFILE_COUNTER("solver steps", steps);
+
+            {
+                PROFILE_SCOPE("clear");
+                glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT);
+            }
 
-            updateGrid(deltaTime);
+            updateGrid(deltaTime, steps, events);
 
-            glUseProgram(shaderProgram);
-            grid.render();
+            {
+                PROFILE_SCOPE("render");
+                glUseProgram(shaderProgram);
+                if (renderMode == MESH) grid.render();
+                else densityTexture.render();
+            }
+            {
+                PROFILE_SCOPE("swapBuffers");
+                glfwSwapBuffers(window);
+            }
+            {
+                PROFILE_SCOPE("pollEvents");
+                glfwPollEvents();
+            }
+            profiler.endFrame();
 
-            glfwSwapBuffers(window);
-            glfwPollEvents();
+            if (showStats) updateStatsOverlay();
         };
 
     }
 
-    void updateGrid(float deltaTime) {
-        addExternalForces(deltaTime);
-        updateVelocities(deltaTime);
-        updateDensities(deltaTime);
-
-        for (uint32_t i = 0; i < grid.size(); i++){
-            curState.density[i] = std::clamp(curState.density[i] - deltaTime*dissolveFactor, 0.0f, 2.0f);
-            grid.updateColor(i,curState.density[i]);
+    // Runs the fixed steps due this frame. Pipelined, the steps started last
+    // frame are uploaded and the new ones run on the worker while this frame
+    // is drawn, so the picture is one frame behind the input.
+    void updateGrid(float deltaTime, uint32_t steps, const std::vector<InputEvent>& events) {
+        if (replay.frameCount() > 0) {
+            playRecording(steps);
+            return;
         }
-
-        grid.updateBuffer();
-    }
-
-    void addExternalForces(float deltaTime) {
-        static double prevPos[2]{0.0f,0.0f};
-        double x, y;
-        glfwGetCursorPos(window, &x, &y);
-        y = HEIGHT - y;
-
-        auto i = (uint32_t) (x/SIZE), j = (uint32_t) (y/SIZE);
-        if (x > 0 && x < WIDTH && y > 0 && y < HEIGHT) {
-            if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
-                curState.density(i, j) += 0.6;
-            }
-
-            curState.velX(i, j) = initialSpeed*deltaTime*float(x - prevPos[0]);
-            curState.velY(i, j) = initialSpeed*deltaTime*float(y - prevPos[1]);
-
-            prevPos[0] = x;
-            prevPos[1] = y;
+        if (pipelined && stepWorker.busy()) {
+            // Waiting would block the browser's main thread, so while the
+            // worker is still stepping the last picture stays up and the input
+            // and steps carry over to the next frame, which runs and logs
+            // them as one batch
+            deferredEvents.insert(deferredEvents.end(), events.begin(), events.end());
+            deferredTime += deltaTime;
+            deferredSteps += steps;
+            PROFILE_COUNTER("deferred steps", deferredSteps);
+            return;
+        }
+        // The worker is idle, so its last batch is complete
+        if (pipelined) finishBatch();
+        std::vector<InputEvent> batch;
+        batch.swap(deferredEvents);
+        batch.insert(batch.end(), events.begin(), events.end());
+        deltaTime += deferredTime;
+        steps = std::min(steps + deferredSteps, timestep.maxSteps);
+        deferredTime = 0.0f;
+        deferredSteps = 0;
+        {
+            PROFILE_SCOPE("externalForces");
+            inputForces.frame(solver, batch, deltaTime, steps);
+        }
+        if (recordingInput) inputLog.append(deltaTime, batch, steps);
+        uploadAlpha = timestep.alpha();
+        batchSteps = steps;
+        if (pipelined) {
+            stepWorker.run([this, steps] { stepSolver(steps); });
+        } else {
+            stepSolver(steps);
+            finishBatch();
         }
-
-
-    }
-
-    void updateDensities(float deltaTime) {
-        curState.density.swap(prevState.density);
-        diffuse(curState.density, prevState.density, diffusionFactor, deltaTime);
-        curState.density.swap(prevState.density);
-        advect(curState.density, prevState.density, curState.velX, curState.velY, deltaTime);
     }
 
-    void updateVelocities(float deltaTime) {
-        curState.velX.swap(prevState.velX);
-        curState.velY.swap(prevState.velY);
-        diffuse(curState.velX, prevState.velX, viscosity, deltaTime);
-        diffuse(curState.velY, prevState.velY, viscosity, deltaTime);
-
-        project(curState.velX, curState.velY, prevState.velX, prevState.velY);
-
-        curState.velX.swap(prevState.velX);
-        curState.velY.swap(prevState.velY);
-        advect(curState.velX, prevState.velX, prevState.velX, prevState.velY, deltaTime, MIRROR_X);
-        advect(curState.velY, prevState.velY, prevState.velX, prevState.velY, deltaTime, MIRROR_Y);
-
-        project(curState.velX, curState.velY, prevState.velX, prevState.velY);
+    // Shows, and records when asked, the state the last batch of steps left
+    void finishBatch() {
+        uploadDensity();
+        if (batchSteps > 0 && recording) {
+            PROFILE_SCOPE("record");
+            recorder.push(solver);
+        }
     }
 
-    static void diffuse(Matrix<float, INSTANCE_COUNT, numTilesX>& x, const Matrix<float, INSTANCE_COUNT, numTilesX>& x0, float diff, float dt){
-        float a = dt*diff*(float)(numTilesMiddleY*numTilesMiddleX);
-        for (uint32_t k = 0; k < 20; ++k) {
-            for (uint32_t j = 1; j <= numTilesMiddleY; ++j) {
-                for (uint32_t i = 1; i <= numTilesMiddleX; ++i) {
-                    x(i,j) = (x0(i,j) + a*(x(i-1,j) + x(i+1,j) + x(i,j-1) + x(i,j+1)))/(1+4*a);
-                }
-            }
-            setBounds(x, REGULAR);
+    // Plays the recording's density frames at the solver step rate, looping;
+    // float32 frames go from the mapped file to the texture without a copy
+    void playRecording(uint32_t steps) {
+        replayFrame = (replayFrame + steps) % replay.frameCount();
+        PROFILE_SCOPE("upload");
+        if (const float* density = replay.field(replayFrame, snapshot::DENSITY)) {
+            densityTexture.update(density, replay.header().width);
         }
     }
 
-    static void advect(Matrix<float, INSTANCE_COUNT, numTilesX>& d, const Matrix<float, INSTANCE_COUNT, numTilesX>& d0, const Matrix<float, INSTANCE_COUNT, numTilesX>& velX, const Matrix<float, INSTANCE_COUNT, numTilesX>& velY, float dt, BoundConfig b = REGULAR){
-        int i0, j0, i1, j1;
-        float x, y, s0, t0, s1, t1;
-        auto fNX = (float) numTilesMiddleX;
-        auto fNY = (float) numTilesMiddleY;
-        float dt0 = dt*std::min(fNX, fNY);
-
-        for (uint32_t j = 1; j <= numTilesMiddleY; ++j) {
-            for (uint32_t i = 1; i <= numTilesMiddleX; ++i) {
-                x = (float) i - dt0*velX(i, j);
-                if (x < 0.5f) x = 0.5f;
-                if (x > fNX + 0.5f) x = fNX + 0.5f;
-                y = (float) j - dt0*velY(i, j);
-                if (y < 0.5f) y = 0.5f;
-                if (y > fNY + 0.5f) y = fNY + 0.5f;
-                i0 = (int) x;
-                i1 = i0 + 1;
-                j0 = (int) y;
-                j1 = j0 + 1;
-                s1 = x - (float) i0;
-                t1 = y - (float) j0;
-                s0 = 1 - s1;
-                t0 = 1 - t1;
-
-                d(i, j) = s0*(t0*d0(i0, j0) + t1*d0(i0, j1)) + s1*(t0*d0(i1, j0) + t1*d0(i1, j1));
-            }
+    void stepSolver(uint32_t steps) {
+        for (uint32_t k = 0; k < steps; ++k) {
+            // The display interpolates between the last two fixed steps
+            if (k + 1 == steps && interpolate) previousDensity = solver.curState.density;
+            solver.advance(timestep.stepSize());
         }
-        setBounds(d, b);
     }
 
-    static void project(Matrix<float, INSTANCE_COUNT, numTilesX> &velX, Matrix<float, INSTANCE_COUNT, numTilesX> &velY, Matrix<float, INSTANCE_COUNT, numTilesX> &div, Matrix<float, INSTANCE_COUNT, numTilesX> &p) {
-        float h = 1/(float) std::min(numTilesMiddleX, numTilesMiddleY);
-
-        for (uint32_t j = 1; j <= numTilesMiddleY; ++j) {
-            for (uint32_t i = 1; i <= numTilesMiddleX; ++i) {
-                div(i, j) = -0.5f*h*(velX(i + 1, j) - velX(i - 1, j) + velY(i, j + 1) - velY(i, j - 1));
-                p(i, j) = 0;
-            }
+    void uploadDensity() {
+        PROFILE_SCOPE("upload");
+        if (renderMode == MESH) {
+            grid.updateBuffer();
+        } else {
+            const FluidSolver::Field& density = solver.curState.density;
+            bool blend = interpolate && previousDensity.size() == density.size();
+            densityTexture.update(density.data(), density.stride(), blend ? previousDensity.data() : nullptr,
+                                  uploadAlpha);
         }
-        setBounds(div);
-        setBounds(p);
+    }
 
+    // Rolling avg/p99 in the window title, the full table on stdout every couple of seconds
+    void updateStatsOverlay() {
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastStatsTime < std::chrono::milliseconds(500)) return;
+        lastStatsTime = now;
 
-        for (uint32_t k = 0; k < 20; ++k) {
-            for (uint32_t j = 1; j <= numTilesMiddleY; ++j) {
-                for (uint32_t i = 1; i <= numTilesMiddleX; ++i) {
-                    p(i,j) = (div(i,j) + p(i + 1,j) + p(i - 1,j) + p(i,j + 1) + p(i,j - 1))/4;
-                }
-            }
-            setBounds(p);
-        }
+        std::string title = profiler.summary({"frame", "step", "upload", "render"});
+        glfwSetWindowTitle(window, title.c_str());
+        if (++statsPrints % 4 == 0) profiler.printStats(std::cout);
+    }
 
-        for (uint32_t j = 1; j <= numTilesMiddleY; ++j) {
-            for (uint32_t i = 1; i <= numTilesMiddleX; ++i) {
-                velX(i,j) -= 0.5f*(p(i + 1,j) - p(i - 1,j))/h;
-                velY(i,j) -= 0.5f*(p(i,j + 1) - p(i,j - 1))/h;
-            }
+    static void onKey(GLFWwindow* window, int key, int, int action, int) {
+        auto sim = (FluidSimulation *) glfwGetWindowUserPointer(window);
+        if (action != GLFW_PRESS || !sim) return;
+        if (key == GLFW_KEY_P) {
+            sim->showStats = !sim->showStats;
+            if (!sim->showStats) glfwSetWindowTitle(window, "Emscripten webgl example");
+        } else if (key == GLFW_KEY_T && !sim->tracePath.empty()) {
+            if (sim->profiler.writeChromeTrace(sim->tracePath)) std::cout << "Wrote " << sim->tracePath << std::endl;
         }
-        setBounds(velX, MIRROR_X);
-        setBounds(velY, MIRROR_Y);
-
     }
 
-    static void setBounds(Matrix<float, INSTANCE_COUNT, numTilesX>& x, BoundConfig b = REGULAR) {
-        for (uint32_t i = 1; i <= numTilesMiddleX; ++i) {
-            x(i, 0) = (b == MIRROR_Y) ? -x(i, 1) : x(i, 1);
-            x(i, numTilesMiddleY+1) = (b == MIRROR_Y) ? -x(i, numTilesMiddleY) : x(i, numTilesMiddleY);
-        }
-        for (uint32_t i = 1; i <= numTilesMiddleY; ++i) {
-            x(0, i) = (b == MIRROR_X) ? -x(1, i) : x(1, i);
-            x(numTilesMiddleX+1, i) = (b == MIRROR_X) ? -x(numTilesMiddleX, i) : x(numTilesMiddleX, i);
+    // Replays take the time, input and steps of a batch from the log, live
+    // input is dropped. The next batch waits for frames where the worker is
+    // still busy, so each runs as logged; the window closes once the log runs
+    // out. Returns the steps to run.
+    uint32_t nextReplayedInput(float& deltaTime, std::vector<InputEvent>& events) {
+        deltaTime = 0.0f;
+        events.clear();
+        if (pipelined && stepWorker.busy()) return 0;
+        if (inputFrame >= inputReplay.frames().size()) {
+            glfwSetWindowShouldClose(window, GLFW_TRUE);
+            return 0;
         }
+        const InputLog::Frame& frame = inputReplay.frames()[inputFrame++];
+        deltaTime = frame.elapsed;
+        events = frame.events;
+        // Keeps the display interpolation moving
+        uint32_t steps = timestep.advance(frame.elapsed);
+        return frame.steps >= 0 ? (uint32_t) frame.steps : steps;
+    }
 
+    // Window callbacks only queue the input, the next frame turns it into forces
+    void queueInput(InputEvent::Type type, double x, double y) {
+        pendingInput.push_back({type, glfwGetTime(), (float) x, (float) (HEIGHT - y)});
+    }
 
-        x(0, 0) = 0.5f*(x(1, 0)+x(0, 1));
-        x(0, numTilesMiddleY+1) = 0.5f*(x(1, numTilesMiddleY+1)+x(0, numTilesMiddleY));
-        x(numTilesMiddleX+1, 0) = 0.5f*(x(numTilesMiddleX, 0)+x(numTilesMiddleX+1, 1));
-        x(numTilesMiddleX+1, numTilesMiddleY+1) = 0.5f*(x(numTilesMiddleX, numTilesMiddleY+1)+x(numTilesMiddleX+1, numTilesMiddleY));
+    static void onCursorPos(GLFWwindow* window, double x, double y) {
+        auto sim = (FluidSimulation *) glfwGetWindowUserPointer(window);
+        if (sim) sim->queueInput(InputEvent::POINTER_MOVE, x, y);
     }
 
+    static void onMouseButton(GLFWwindow* window, int button, int action, int) {
+        auto sim = (FluidSimulation *) glfwGetWindowUserPointer(window);
+        if (!sim || (button != GLFW_MOUSE_BUTTON_LEFT && button != GLFW_MOUSE_BUTTON_RIGHT)) return;
+        double x, y;
+        glfwGetCursorPos(window, &x, &y);
+        if (button == GLFW_MOUSE_BUTTON_RIGHT) {
+            sim->queueInput(action == GLFW_PRESS ? InputEvent::WALL_DOWN : InputEvent::WALL_UP, x, y);
+        } else {
+            sim->queueInput(action == GLFW_PRESS ? InputEvent::POINTER_DOWN : InputEvent::POINTER_UP, x, y);
+        }
+    }
 
 public:
+    enum RenderMode {
+        MESH,   // Grid2D, one coloured vertex per cell, canvas-sized grids only
+        TEXTURE // DensityTexture, any grid size
+    };
+
     GLFWwindow* window = nullptr;
     GLuint shaderProgram{};
     Grid2D grid{};
-
-    FluidData curState, prevState;
-    float viscosity = 0.005f, diffusionFactor = 0.001f, dissolveFactor = 0.02f, initialSpeed = 60.0f, deltaT;
+    DensityTexture densityTexture{};
+    RenderMode renderMode = TEXTURE;
+    DensityTexture::Format textureFormat = DensityTexture::R8;
+
+    // One solver cell per grid vertex, so the interior is one cell short of the canvas
+    FluidSolver solver{WIDTH/SIZE - 1, HEIGHT/SIZE - 1};
+    // Pointer input queued by the callbacks until the next frame, and the
+    // forces it becomes. --record-input logs the time, input and steps of
+    // every batch, --replay-input plays a log back batch by batch.
+    std::vector<InputEvent> pendingInput;
+    InputForces inputForces{WIDTH, HEIGHT};
+    InputLog inputLog;
+    bool recordingInput = false;
+    InputLog inputReplay;
+    size_t inputFrame = 0;
+
+    // Solver steps at a fixed rate whatever the display does, advection
+    // substeps above one cell per step, and the texture shows the state
+    // interpolated between the last two steps (the mesh shows the last one)
+    FixedTimestep timestep{60.0f, 4};
+    uint32_t batchSteps = 0;
+    bool interpolate = true;
+    FluidSolver::Field previousDensity;
+    float uploadAlpha = 1.0f;
+    // Steps the solver while the main thread renders, declared after the
+    // solver so it is stopped first
+    BackgroundWorker stepWorker;
+    bool pipelined = true;
+    // Input, frame time and steps of the frames that found the worker busy
+    std::vector<InputEvent> deferredEvents;
+    float deferredTime = 0.0f;
+    uint32_t deferredSteps = 0;
+
+    // Last ~10 s of frames at 60 Hz
+    Profiler profiler{600};
+    bool showStats = false;
+    std::string tracePath;
+    std::chrono::steady_clock::time_point lastStatsTime{};
+    uint32_t statsPrints = 0;
+
+    // --record streams the density to a snapshot file, --replay plays one back
+    SnapshotWriter recorder;
+    bool recording = false;
+    SnapshotReader replay;
+    uint32_t replayFrame = 0;
 };
 
 
@@ -386,33 +477,122 @@ void mainLoop() { FluidSimulation::loop(); }
 
 #ifdef EMSCRIPTEN
 EM_BOOL onTouchMove(int eventType, const EmscriptenTouchEvent *touchEvent, void *userData){
-    static double prevPos[2]{0.0f,0.0f};
     auto sim = (FluidSimulation *) userData;
-    auto x = (float) touchEvent->touches[0].targetX;
-    auto y = (float) touchEvent->touches[0].targetY;
-    y = FluidSimulation::HEIGHT - y;
-
-    auto i = (uint32_t) (x/FluidSimulation::SIZE), j = (uint32_t) (y/FluidSimulation::SIZE);
-    if (x > 0 && x < FluidSimulation::WIDTH && y > 0 && y < FluidSimulation::HEIGHT) {
-        sim->curState.density(i, j) += 2.0f;
-
-        sim->curState.velX(i, j) = 20*sim->deltaT*float(x - prevPos[0]);
-        sim->curState.velY(i, j) = 20*sim->deltaT*float(y - prevPos[1]);
-
-        prevPos[0] = x;
-        prevPos[1] = y;
-    }
+    sim->queueInput(InputEvent::TOUCH, touchEvent->touches[0].targetX, touchEvent->touches[0].targetY);
     return true;
 }
 #endif
 
-int main() {
+int main(int argc, char** argv) {
     std::cout << "Starting 3" << std::endl;
     GLFWwindow* window = nullptr;
 
 
     FluidSimulation example{window};
 
+    // --stats shows frame timings from the start (P toggles them), --trace
+    // <file> writes the buffered frames as a Chrome trace on exit or on T.
+    // --cells WxH simulates a grid of any size, drawn as a texture; --mesh
+    // draws the canvas grid as coloured vertices and --r16f uploads floats.
+    // --no-pipeline steps the solver on the main thread before drawing.
+    // --step-rate HZ sets the fixed solver rate (60), --max-cfl C the
+    // advection substep limit (1, 0 disables) and --no-interpolation shows
+    // the last solver state as is. --sparse only steps the tiles with smoke
+    // in them. --maccormack and --bfecc pick the corrected advection
+    // schemes, --cubic monotonic cubic interpolation, and --vorticity E /
+    // --buoyancy B turn on the force stage.
+    // --obstacles FILE loads solid cells from a PGM image, dark pixels are
+    // walls; dragging with the right button draws more of them.
+    // --threads N splits the solver kernels over N threads (the pthread web
+    // build uses its whole worker pool).
+    // --record FILE writes the density of every step as a compressed
+    // snapshot recording, --replay FILE shows one. --record-input FILE logs
+    // the pointer input, time and steps of every batch, and --replay-input
+    // FILE runs a log again, solver settings included; fluid_sim_cli --input
+    // FILE replays it headless to the same fields.
+    std::string recordPath, replayPath, recordInputPath, replayInputPath, obstaclesPath;
+#ifdef __EMSCRIPTEN_PTHREADS__
+    // The step worker is one of the pool's Web Workers and takes band 0, the
+    // others run the remaining bands; asking for more would wait forever on
+    // a worker the browser never starts
+    uint32_t threads = std::min(std::max(std::thread::hardware_concurrency(), 1u), (uint32_t) FLUID_WASM_WORKERS);
+#else
+    uint32_t threads = 1;
+#endif
+    for (int a = 1; a < argc; ++a) {
+        std::string arg = argv[a];
+        uint32_t cellsX, cellsY;
+        if (arg == "--stats") example.showStats = true;
+        else if (arg == "--mesh") example.renderMode = FluidSimulation::MESH;
+        else if (arg == "--no-pipeline") example.pipelined = false;
+        else if (arg == "--no-interpolation") example.interpolate = false;
+        else if (arg == "--sparse") example.solver.sparseTiles = true;
+        else if (arg == "--maccormack") example.solver.advection = FluidSolver::MACCORMACK;
+        else if (arg == "--bfecc") example.solver.advection = FluidSolver::BFECC;
+        else if (arg == "--cubic") example.solver.interpolation = FluidSolver::MONOTONIC_CUBIC;
+        else if (arg == "--vorticity" && a + 1 < argc) example.solver.vorticity = std::strtof(argv[++a], nullptr);
+        else if (arg == "--buoyancy" && a + 1 < argc) example.solver.buoyancy = std::strtof(argv[++a], nullptr);
+        else if (arg == "--record" && a + 1 < argc) recordPath = argv[++a];
+        else if (arg == "--replay" && a + 1 < argc) replayPath = argv[++a];
+        else if (arg == "--obstacles" && a + 1 < argc) obstaclesPath = argv[++a];
+        else if (arg == "--threads" && a + 1 < argc) threads = (uint32_t) std::strtoul(argv[++a], nullptr, 10);
+        else if (arg == "--record-input" && a + 1 < argc) recordInputPath = argv[++a];
+        else if (arg == "--replay-input" && a + 1 < argc) replayInputPath = argv[++a];
+        else if (arg == "--step-rate" && a + 1 < argc) example.timestep.setStepRate(std::strtof(argv[++a], nullptr));
+        else if (arg == "--max-cfl" && a + 1 < argc) example.solver.maxCfl = std::strtof(argv[++a], nullptr);
+        else if (arg == "--r16f") example.textureFormat = DensityTexture::R16F;
+        else if (arg == "--trace" && a + 1 < argc) example.tracePath = argv[++a];
+        else if (arg == "--cells" && a + 1 < argc && std::sscanf(argv[++a], "%ux%u", &cellsX, &cellsY) == 2
+                 && cellsX >= 2 && cellsY >= 2) {
+            example.solver.resize(cellsX, cellsY);
+        }
+    }
+    if (!obstaclesPath.empty() && !example.solver.obstacles.loadPgm(obstaclesPath)) return EXIT_FAILURE;
+#ifdef __EMSCRIPTEN_PTHREADS__
+    // Every thread takes a worker from the preallocated pool: the step
+    // worker, the solver pool's threads - 1 and the recorder's writer
+    static_assert(FLUID_WASM_WORKERS >= 1, "the threaded web build needs a worker for the solver steps");
+    uint32_t reserved = recordPath.empty() ? 1 : 2;
+    if (threads + reserved - 1 > FLUID_WASM_WORKERS) {
+        threads = FLUID_WASM_WORKERS >= reserved ? FLUID_WASM_WORKERS - reserved + 1 : 1;
+        std::cout << "Only " << FLUID_WASM_WORKERS << " Web Workers, using " << threads << " solver threads" << std::endl;
+    }
+#endif
+    example.solver.setThreadCount(std::max(threads, 1u));
+    if (!replayPath.empty() && example.replay.open(replayPath)) {
+        const snapshot::FileHeader& header = example.replay.header();
+        if (!example.replay.hasField(snapshot::DENSITY)) {
+            std::cout << replayPath << " has no density to show" << std::endl;
+            return EXIT_FAILURE;
+        }
+        example.solver.resize(header.width - 2, header.height - 2);
+        example.timestep.setStepRate(header.dt > 0.0f ? 1.0f/header.dt : 60.0f);
+        example.renderMode = FluidSimulation::TEXTURE;
+    }
+    if (!replayInputPath.empty()) {
+        if (!example.inputReplay.load(replayInputPath)) return EXIT_FAILURE;
+        const InputLog::Settings& settings = example.inputReplay.settings();
+        InputLog::apply(settings, example.solver, example.timestep);
+        example.inputForces = InputForces{settings.canvasWidth, settings.canvasHeight};
+    }
+    if (!recordInputPath.empty()) {
+        example.recordingInput = example.inputLog.create(recordInputPath,
+            InputLog::settingsOf(example.solver, example.timestep, FluidSimulation::WIDTH, FluidSimulation::HEIGHT));
+    }
+    if (!recordPath.empty()) {
+        snapshot::FileHeader header = snapshot::headerFor(example.solver, snapshot::DENSITY_ONLY,
+                                                          example.timestep.stepSize());
+        header.encoding = snapshot::FLOAT16;
+        header.compression = snapshot::DELTA;
+        example.recording = example.recorder.open(recordPath, header);
+    }
+    if (example.renderMode == FluidSimulation::MESH
+        && (example.solver.numTilesX() != FluidSimulation::WIDTH/FluidSimulation::SIZE + 1
+            || example.solver.numTilesY() != FluidSimulation::HEIGHT/FluidSimulation::SIZE + 1)) {
+        std::cout << "--mesh only draws the canvas sized grid, using a texture" << std::endl;
+        example.renderMode = FluidSimulation::TEXTURE;
+    }
+
     std::cout << "Going into loop" << std::endl;
     example.createMainLoop();
 
@@ -423,6 +603,7 @@ int main() {
     emscripten_set_main_loop(&mainLoop, 0, 1);
 #else
     example.glfwLoop();
+    if (!example.tracePath.empty()) example.profiler.writeChromeTrace(example.tracePath);
 #endif
 
     std::cout << "Loop ended" << std::endl;
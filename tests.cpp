@@ -0,0 +1,344 @@
+#include "Fixed16.h"
+#include "FluidSolver.h"
+#include "InputEvents.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Solver checks run by ctest, one per invocation: fluid_sim_tests NAME
+
+namespace {
+
+constexpr uint32_t WALL_GRID = 64;
+constexpr uint32_t WALL_X = 32;
+
+struct Leak {
+    float maxVelocity = 0.0f, density = 0.0f;
+};
+
+// Pushes smoke from the left into a wall across the whole grid and reports
+// what arrives on its right
+Leak leakAcrossWall(FluidSolver::PressureSolver pressureSolver, uint32_t thickness) {
+    FluidSolver solver{WALL_GRID, WALL_GRID};
+    solver.pressureSolver = pressureSolver;
+    solver.pressureIterations = pressureSolver == FluidSolver::GAUSS_SEIDEL ? 40 : 200;
+    solver.pressureTolerance = 1e-5f;
+    solver.dissolveFactor = 0.0f;
+    for (uint32_t j = 1; j <= WALL_GRID; ++j) {
+        for (uint32_t i = WALL_X; i < WALL_X + thickness; ++i) solver.obstacles.set(i, j, true);
+    }
+    solver.reset();
+    const float dt = 1.0f/60.0f;
+    for (int frame = 0; frame < 120; ++frame) {
+        for (uint32_t j = 16; j <= 48; ++j) {
+            solver.addDensity(WALL_X - 8, j, 0.5f);
+            solver.setVelocity(WALL_X - 8, j, 1.0f, 0.0f);
+        }
+        solver.step(dt);
+    }
+    Leak leak;
+    for (uint32_t j = 1; j <= WALL_GRID; ++j) {
+        for (uint32_t i = WALL_X + thickness; i <= WALL_GRID; ++i) {
+            leak.maxVelocity = std::max({leak.maxVelocity, std::abs(solver.curState.velX(i, j)),
+                                         std::abs(solver.curState.velY(i, j))});
+            leak.density += solver.curState.density(i, j);
+        }
+    }
+    return leak;
+}
+
+bool checkWall(FluidSolver::PressureSolver pressureSolver) {
+    bool ok = true;
+    for (uint32_t thickness : {1u, 6u}) {
+        Leak leak = leakAcrossWall(pressureSolver, thickness);
+        std::cout << thickness << "-cell wall: max velocity behind it " << leak.maxVelocity << ", density "
+                  << leak.density << std::endl;
+        ok = ok && leak.maxVelocity < 1e-3f && leak.density < 1e-3f;
+    }
+    return ok;
+}
+
+// A plume rising into a cross whose arms end in open fluid, stepped on
+// sparse tiles. Tiles that are not active must stay exactly zero, solid
+// cells included, or the wall passes feed stale values back into the fluid.
+bool checkSparseWall() {
+    FluidSolver solver{WALL_GRID, WALL_GRID};
+    solver.sparseTiles = true;
+    for (uint32_t j = 40; j <= 44; ++j) {
+        for (uint32_t i = 6; i <= 58; ++i) solver.obstacles.set(i, j, true);
+    }
+    for (uint32_t j = 16; j <= 56; ++j) {
+        for (uint32_t i = WALL_X - 1; i <= WALL_X + 1; ++i) solver.obstacles.set(i, j, true);
+    }
+    solver.reset();
+    const float dt = 1.0f/60.0f;
+    for (int frame = 0; frame < 300; ++frame) {
+        solver.addDensity(WALL_X, 2, 0.6f);
+        solver.setVelocity(WALL_X, 2, 0.0f, 1.0f);
+        solver.step(dt);
+        const ActiveTiles& tiles = solver.activeTiles();
+        for (uint32_t j = 1; j <= WALL_GRID; ++j) {
+            for (uint32_t i = 1; i <= WALL_GRID; ++i) {
+                if (tiles.active(i, j)) continue;
+                float value = std::max({std::abs(solver.curState.density(i, j)), std::abs(solver.curState.velX(i, j)),
+                                        std::abs(solver.curState.velY(i, j))});
+                if (value != 0.0f) {
+                    std::cout << "frame " << frame << ": idle cell (" << i << ", " << j << ") holds " << value
+                              << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+    std::cout << "idle tiles stayed zero, max speed " << solver.maxVelocity() << std::endl;
+    return true;
+}
+
+using Setup = std::function<void(FluidSolver&)>;
+
+// Solver settings a check runs under, each on top of the defaults
+const std::vector<std::pair<std::string, Setup>>& variants() {
+    static const std::vector<std::pair<std::string, Setup>> list{
+        {"lexicographic", [](FluidSolver&) {}},
+        {"red-black", [](FluidSolver& s) { s.relaxation = FluidSolver::RED_BLACK; }},
+        {"blocked", [](FluidSolver& s) { s.blockedSweeps = true; }},
+        {"unfused", [](FluidSolver& s) { s.fusedStep = false; }},
+        {"sparse", [](FluidSolver& s) { s.sparseTiles = true; }},
+        {"walls", [](FluidSolver& s) {
+            for (uint32_t i = s.numTilesMiddleX()/3; i <= 2*s.numTilesMiddleX()/3; ++i) {
+                s.obstacles.set(i, s.numTilesMiddleY()/2, true);
+            }
+        }},
+        {"multigrid", [](FluidSolver& s) { s.pressureSolver = FluidSolver::MULTIGRID; }},
+        {"cg", [](FluidSolver& s) { s.pressureSolver = FluidSolver::CONJUGATE_GRADIENT; }},
+        {"bfecc", [](FluidSolver& s) {
+            s.advection = FluidSolver::BFECC;
+            s.interpolation = FluidSolver::MONOTONIC_CUBIC;
+            s.vorticity = 0.5f;
+            s.buoyancy = 1.0f;
+        }},
+        {"fixed16", [](FluidSolver& s) {
+            s.densityStorage = FluidSolver::FIXED16;
+            s.buoyancy = 1.0f;
+        }},
+    };
+    return list;
+}
+
+// The CLI's default workload: a plume rising from the bottom centre. The
+// float density is up to date afterwards, whatever the storage.
+void stepPlume(FluidSolver& solver, int frames) {
+    const float dt = 1.0f/60.0f;
+    uint32_t i = solver.numTilesMiddleX()/2;
+    for (int frame = 0; frame < frames; ++frame) {
+        solver.addDensity(i, 2, 0.6f);
+        solver.setVelocity(i, 2, 0.0f, 1.0f);
+        solver.step(dt);
+    }
+    solver.unpackDensity();
+}
+
+// Bit for bit, boundary cells included
+bool sameState(const FluidSolver& a, const FluidSolver& b) {
+    const FluidSolver::Field* fieldsA[] = {&a.curState.density, &a.curState.velX, &a.curState.velY};
+    const FluidSolver::Field* fieldsB[] = {&b.curState.density, &b.curState.velX, &b.curState.velY};
+    for (size_t f = 0; f < 3; ++f) {
+        for (uint32_t j = 0; j < fieldsA[f]->height(); ++j) {
+            if (std::memcmp(&(*fieldsA[f])(0, j), &(*fieldsB[f])(0, j), fieldsA[f]->width()*sizeof(float)) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// The vector kernels against the scalar ones, on the fixed canvas shape and
+// on a grid whose rows end in partial vectors
+bool checkSimdEquivalence() {
+    std::cout << "vector kernels: " << FluidSolver::simdName() << std::endl;
+    bool ok = true;
+    for (const auto& variant : variants()) {
+        for (auto size : {std::make_pair(29u, 53u), std::make_pair(61u, 47u)}) {
+            FluidSolver vector{size.first, size.second}, scalar{size.first, size.second};
+            scalar.simd = false;
+            for (FluidSolver* solver : {&vector, &scalar}) {
+                variant.second(*solver);
+                solver->reset();
+                stepPlume(*solver, 60);
+            }
+            bool same = sameState(vector, scalar);
+            std::cout << variant.first << " " << size.first << "x" << size.second << ": "
+                      << (same ? "identical" : "DIFFERENT") << std::endl;
+            ok = ok && same;
+        }
+    }
+    return ok;
+}
+
+// Every solver option steps to the same bits on 2 to 4 threads as on one:
+// rows are split, never the order of a sum or a Gauss-Seidel sweep
+bool checkThreadDeterminism() {
+    bool ok = true;
+    for (const auto& variant : variants()) {
+        FluidSolver serial{96, 80};
+        variant.second(serial);
+        serial.reset();
+        stepPlume(serial, 60);
+        for (uint32_t threads = 2; threads <= 4; ++threads) {
+            FluidSolver parallel{96, 80};
+            parallel.setThreadCount(threads);
+            variant.second(parallel);
+            parallel.reset();
+            stepPlume(parallel, 60);
+            bool same = sameState(serial, parallel);
+            std::cout << variant.first << " on " << threads << " threads: " << (same ? "identical" : "DIFFERENT")
+                      << std::endl;
+            ok = ok && same;
+        }
+    }
+    return ok;
+}
+
+// The fixed point density against float32, under settings it has its own
+// kernels for and under BFECC, which advects an unpacked copy. Every code
+// must survive a round trip. The stepped density drifts by rounding, about
+// 6e-4 in a cell and 0.1% in total here; the bounds leave a few times that.
+bool checkDensityStorage() {
+    uint32_t unstable = 0;
+    for (uint32_t code = 0; code <= 0xffffu; ++code) {
+        unstable += fixed16::fromFloat(fixed16::toFloat((uint16_t) code)) != code;
+    }
+    std::cout << "codes changed by a round trip: " << unstable << std::endl;
+    bool ok = unstable == 0;
+
+    const float MAX_CELL_ERROR = 0.002f, MAX_TOTAL_ERROR = 0.005f;
+    for (const char* name : {"lexicographic", "red-black", "unfused", "sparse", "walls", "bfecc"}) {
+        auto variant = std::find_if(variants().begin(), variants().end(), [&](const auto& v) { return v.first == name; });
+        FluidSolver reference{96, 96}, packed{96, 96};
+        packed.densityStorage = FluidSolver::FIXED16;
+        for (FluidSolver* solver : {&reference, &packed}) {
+            variant->second(*solver);
+            solver->reset();
+            stepPlume(*solver, 240);
+        }
+        float cellError = 0.0f;
+        double total = 0.0, packedTotal = 0.0;
+        for (uint32_t j = 0; j <= 97; ++j) {
+            for (uint32_t i = 0; i <= 97; ++i) {
+                cellError = std::max(cellError, std::abs(packed.curState.density(i, j) - reference.curState.density(i, j)));
+                total += reference.curState.density(i, j);
+                packedTotal += packed.curState.density(i, j);
+            }
+        }
+        auto totalError = (float) (std::abs(packedTotal - total)/total);
+        std::cout << name << ": max |diff| " << cellError << ", total density " << packedTotal << " vs " << total
+                  << std::endl;
+        ok = ok && cellError <= MAX_CELL_ERROR && totalError <= MAX_TOTAL_ERROR;
+    }
+    return ok;
+}
+
+// The pointer input of a viewer session: frame k's events, at time t
+std::vector<InputEvent> sessionEvents(int k, double t) {
+    auto at = [&](InputEvent::Type type, float x, float y) { return InputEvent{type, t, x, y}; };
+    float x = 225.0f + 120.0f*(float) std::cos(0.05*k), y = 300.0f + 150.0f*(float) std::sin(0.07*k);
+    std::vector<InputEvent> events{at(InputEvent::POINTER_MOVE, x, y)};
+    if (k == 10) events.push_back(at(InputEvent::POINTER_DOWN, x, y));
+    if (k == 60) events.push_back(at(InputEvent::POINTER_UP, x, y));
+    if (k >= 70 && k < 90) events.push_back(at(InputEvent::TOUCH, 100.0f + 8.0f*(float) (k - 70), 150.0f));
+    if (k == 100) events.push_back(at(InputEvent::WALL_DOWN, x, y));
+    if (k == 120) events.push_back(at(InputEvent::WALL_UP, x, y));
+    return events;
+}
+
+// A session logged while it runs with uneven frame times (stalls included)
+// and, like the pipelined viewer, frames whose steps wait for a busy worker
+// and join the next batch; replayed from the log into a fresh solver, it
+// must end on the same bits
+bool checkInputReplay() {
+    const float canvasWidth = 450.0f, canvasHeight = 810.0f;
+    const std::string path = "input-replay.log";
+    FluidSolver live{29, 53};
+    live.maxCfl = 1.0f;
+    live.sparseTiles = true;
+    live.vorticity = 0.3f;
+    for (uint32_t i = 5; i <= 12; ++i) live.obstacles.set(i, 40, true);
+    live.reset();
+    FixedTimestep liveTimestep;
+    InputForces liveForces{canvasWidth, canvasHeight};
+    {
+        InputLog log;
+        if (!log.create(path, InputLog::settingsOf(live, liveTimestep, canvasWidth, canvasHeight))) return false;
+        double time = 0.0;
+        std::vector<InputEvent> batch;
+        float batchTime = 0.0f;
+        uint32_t batchSteps = 0;
+        for (int k = 0; k < 150; ++k) {
+            float elapsed = k % 37 == 36 ? 0.12f : 0.012f + 0.008f*(float) std::sin(0.3*k);
+            time += elapsed;
+            std::vector<InputEvent> events = sessionEvents(k, time);
+            batch.insert(batch.end(), events.begin(), events.end());
+            batchTime += elapsed;
+            batchSteps += liveTimestep.advance(elapsed);
+            if (k % 3 == 1) continue; // the worker is busy
+            batchSteps = std::min(batchSteps, liveTimestep.maxSteps);
+            liveForces.frame(live, batch, batchTime, batchSteps);
+            log.append(batchTime, batch, batchSteps);
+            for (uint32_t s = 0; s < batchSteps; ++s) live.advance(liveTimestep.stepSize());
+            batch.clear();
+            batchTime = 0.0f;
+            batchSteps = 0;
+        }
+    }
+
+    InputLog log;
+    bool loaded = log.load(path);
+    std::remove(path.c_str());
+    if (!loaded) return false;
+    FluidSolver replay{1, 1};
+    FixedTimestep timestep;
+    InputLog::apply(log.settings(), replay, timestep);
+    replay.reset();
+    InputForces forces{log.settings().canvasWidth, log.settings().canvasHeight};
+    for (const InputLog::Frame& frame : log.frames()) {
+        forces.frame(replay, frame.events, frame.elapsed, (uint32_t) frame.steps);
+        for (int32_t s = 0; s < frame.steps; ++s) replay.advance(timestep.stepSize());
+    }
+
+    bool same = sameState(live, replay);
+    std::cout << log.frames().size() << " logged batches replayed: " << (same ? "identical" : "DIFFERENT")
+              << std::endl;
+    return same;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const std::vector<std::pair<std::string, std::function<bool()>>> tests{
+        {"wall-gauss-seidel", [] { return checkWall(FluidSolver::GAUSS_SEIDEL); }},
+        {"wall-multigrid", [] { return checkWall(FluidSolver::MULTIGRID); }},
+        {"wall-cg", [] { return checkWall(FluidSolver::CONJUGATE_GRADIENT); }},
+        {"wall-sparse", checkSparseWall},
+        {"simd-equivalence", checkSimdEquivalence},
+        {"thread-determinism", checkThreadDeterminism},
+        {"input-replay", checkInputReplay},
+        {"density-storage", checkDensityStorage},
+    };
+    for (const auto& test : tests) {
+        if (argc == 2 && test.first == argv[1]) {
+            bool ok = test.second();
+            if (!ok) std::cerr << test.first << " failed" << std::endl;
+            return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    std::cerr << "Usage: " << argv[0] << " NAME, one of:";
+    for (const auto& test : tests) std::cerr << " " << test.first;
+    std::cerr << std::endl;
+    return EXIT_FAILURE;
+}